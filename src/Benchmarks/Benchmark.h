@@ -0,0 +1,107 @@
+#pragma once
+// STL
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdlib>
+
+namespace bench
+{
+    /** \brief
+     * Stopwatch used to measure the duration of a frame
+     *
+     */
+    class Stopwatch {
+    public:
+        /** Constructor */
+        Stopwatch() : m_start(std::chrono::steady_clock::now()) {}
+
+        /** restart
+         *
+         * Restart the stopwatch
+         */
+        inline void restart() { m_start = std::chrono::steady_clock::now(); }
+
+        /** elapsed
+         *
+         * \return  The time passed since the last restart in milliseconds
+         */
+        inline double elapsed() const
+        {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+        }
+
+    private:
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    /** \brief
+     * Collects frame times and reports their percentiles
+     *
+     */
+    class FrameStats {
+    public:
+        /** add
+         *
+         * Record a frame time
+         *
+         * \param ms    the frame duration in milliseconds
+         */
+        inline void add(double ms) { m_samples.push_back(ms); }
+
+        /** percentile
+         *
+         * \param p     the requested percentile in the range [0, 100]
+         * \return      The frame time at the given percentile (nearest rank)
+         */
+        inline double percentile(double p) const
+        {
+            if (m_samples.empty()) return 0;
+            std::vector<double> sorted(m_samples);
+            std::sort(sorted.begin(), sorted.end());
+            size_t rank = static_cast<size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+            return sorted[std::min(rank, sorted.size() - 1)];
+        }
+
+        /** report
+         *
+         * Print the collected frame time percentiles
+         *
+         * \param out       stream to print into
+         * \param title     the name of the measured phase
+         */
+        inline void report(std::ostream& out, const std::string& title) const
+        {
+            double total = 0;
+            for (double s : m_samples) total += s;
+
+            out << std::fixed << std::setprecision(3)
+                << title << " | frames: " << m_samples.size()
+                << " | mean: " << (m_samples.empty() ? 0 : total / m_samples.size()) << " ms"
+                << " | p50: " << percentile(50) << " ms"
+                << " | p90: " << percentile(90) << " ms"
+                << " | p99: " << percentile(99) << " ms"
+                << " | max: " << percentile(100) << " ms" << std::endl;
+        }
+
+    private:
+        std::vector<double> m_samples;
+    };
+
+    /** argument
+     *
+     * \param argc      main's argc
+     * \param argv      main's argv
+     * \param index     index of the requested argument
+     * \param fallback  value to use if the argument was not given
+     * \return          The argument parsed as an unsigned number
+     */
+    inline unsigned argument(int argc, char** argv, int index, unsigned fallback)
+    {
+        if (index >= argc) return fallback;
+        return static_cast<unsigned>(std::strtoul(argv[index], nullptr, 10));
+    }
+}
@@ -0,0 +1,114 @@
+// Includes
+// STL
+#include <iostream>
+#include <random>
+#include <memory>
+#include <cmath>
+
+#include "Quadtree.h"
+#include "../Benchmark.h"
+
+// Example 1 scene, scaled so the objects density stays the same as in the demo
+static const int WIDTH = 800;
+static const int HEIGHT = 600;
+static const double DEMO_OBJECTS = 100;
+static const unsigned DRAW_DEPTH = 10; // Deeper cells are smaller than a pixel
+
+using QueryCircle = qtree::Circle;
+
+int main(int argc, char** argv)
+{
+    const unsigned objects = bench::argument(argc, argv, 1, 100000);
+    const unsigned frames = bench::argument(argc, argv, 2, 600);
+    const unsigned spawnPerFrame = std::max(1u, objects / 1000);
+    const unsigned removeEvery = 10; // Frames between two presses of 'R'
+    const unsigned removal = bench::argument(argc, argv, 3, 0); // 0 - remove, 1 - deferred remove, 2 - eraseRange
+    const bool deferred = removal == 1;
+
+    const double scale = std::max(1.0, std::sqrt(objects / DEMO_OBJECTS));
+    const qtree::Rect mapBounds(0, 0, WIDTH * scale, HEIGHT * scale);
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> randX(0, mapBounds.width);
+    std::uniform_real_distribution<double> randY(0, mapBounds.height);
+
+    auto m_quadtree = std::make_shared<qtree::QuadTree<qtree::Point>>(mapBounds, 4);
+    m_quadtree->setDeferredRemoval(deferred);
+
+    QueryCircle query(mapBounds.width / 2, mapBounds.height / 2, 100 * scale);
+
+    std::vector<std::unique_ptr<qtree::Point>> points;
+    points.reserve(objects + frames * spawnPerFrame);
+
+    auto spawn = [&]()
+    {
+        double x = randX(rng);
+        double y = randY(rng);
+        points.emplace_back(new qtree::Point(x, y));
+        m_quadtree->insert(*points.back(), x, y);
+    };
+
+    // Fill the scene
+    bench::Stopwatch stopwatch;
+    for (unsigned i = 0; i < objects; i++)
+    {
+        spawn();
+    }
+    std::cout << "Benchmark1 | objects: " << objects << " | removal: " << removal << " | fill: " << stopwatch.elapsed() << " ms" << std::endl;
+
+    bench::FrameStats frameStats;
+    bench::FrameStats removeStats;
+    size_t checksum = 0;
+
+    for (unsigned frame = 0; frame < frames; frame++)
+    {
+        stopwatch.restart();
+
+        // Left mouse button - place new points in the scene
+        for (unsigned i = 0; i < spawnPerFrame; i++)
+        {
+            spawn();
+        }
+
+        // 'R' key - erase the points found by the query
+        bool removeFrame = (frame % removeEvery) == 0;
+        if (removeFrame && removal == 2)
+        {
+            checksum += m_quadtree->eraseRange(query);
+        }
+        else if (removeFrame)
+        {
+            auto found = m_quadtree->query(query);
+            for (const auto& n : found)
+            {
+                m_quadtree->remove(*n);
+            }
+            checksum += found.size();
+        }
+
+        // Draw the quadtree
+        size_t cells = 0;
+        m_quadtree->draw(mapBounds, DRAW_DEPTH, [&](const qtree::Rect&) { cells++; });
+        checksum += cells;
+
+        // Draw found by the query points
+        auto found = m_quadtree->query(query);
+        for (const auto& n : found)
+        {
+            checksum += static_cast<size_t>(n->data->x) & 1;
+        }
+
+        // Erase the removed points at the end of the frame
+        if (deferred) m_quadtree->compact();
+
+        double elapsed = stopwatch.elapsed();
+        frameStats.add(elapsed);
+        if (removeFrame) removeStats.add(elapsed);
+    }
+
+    frameStats.report(std::cout, "all frames   ");
+    removeStats.report(std::cout, "remove frames");
+    std::cout << "checksum: " << checksum << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+// Includes
+// STL
+#include <iostream>
+#include <random>
+#include <memory>
+#include <cmath>
+
+#include "Quadtree.h"
+#include "../Benchmark.h"
+
+// Example 2 scene, scaled so the objects density stays the same as in the demo
+static const int WIDTH = 800;
+static const int HEIGHT = 600;
+static const double DEMO_OBJECTS = 100;
+static const unsigned DRAW_DEPTH = 10; // Deeper cells are smaller than a pixel
+
+using QueryRect = qtree::Rect;
+
+int main(int argc, char** argv)
+{
+    const unsigned objects = bench::argument(argc, argv, 1, 100000);
+    const unsigned frames = bench::argument(argc, argv, 2, 600);
+    const unsigned spawnPerFrame = std::max(1u, objects / 1000);
+
+    const double scale = std::max(1.0, std::sqrt(objects / DEMO_OBJECTS));
+    const qtree::Rect mapBounds(0, 0, WIDTH * scale, HEIGHT * scale);
+
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<double> randX(0, mapBounds.width);
+    std::uniform_real_distribution<double> randY(0, mapBounds.height);
+
+    auto m_quadtree = std::make_shared<qtree::QuadTree<qtree::Point>>(mapBounds, 4);
+
+    QueryRect queryRange(200 * scale, 200 * scale, 200 * scale, 200 * scale);
+
+    std::vector<std::unique_ptr<qtree::Point>> points;
+    points.reserve(objects + frames * spawnPerFrame);
+
+    auto spawn = [&]()
+    {
+        double x = randX(rng);
+        double y = randY(rng);
+        points.emplace_back(new qtree::Point(x, y));
+        m_quadtree->insert(*points.back(), qtree::Rect(x, y, 10, 10));
+    };
+
+    // Fill the scene
+    bench::Stopwatch stopwatch;
+    for (unsigned i = 0; i < objects; i++)
+    {
+        spawn();
+    }
+    std::cout << "Benchmark2 | objects: " << objects << " | fill: " << stopwatch.elapsed() << " ms" << std::endl;
+
+    bench::FrameStats frameStats;
+    size_t checksum = 0;
+
+    for (unsigned frame = 0; frame < frames; frame++)
+    {
+        stopwatch.restart();
+
+        // Left mouse button - place new rectangles in the scene
+        for (unsigned i = 0; i < spawnPerFrame; i++)
+        {
+            spawn();
+        }
+
+        // Draw the quadtree
+        size_t cells = 0;
+        m_quadtree->draw(mapBounds, DRAW_DEPTH, [&](const qtree::Rect&) { cells++; });
+        checksum += cells;
+
+        // Draw found by query rectangles
+        auto found = m_quadtree->query(queryRange);
+        for (const auto& n : found)
+        {
+            checksum += static_cast<size_t>(n->bound.x) & 1;
+        }
+
+        frameStats.add(stopwatch.elapsed());
+    }
+
+    frameStats.report(std::cout, "all frames");
+    std::cout << "checksum: " << checksum << std::endl;
+
+    return 0;
+}
@@ -7,6 +7,7 @@
 
 static const int WIDTH = 800;
 static const int HEIGHT = 600;
+static const unsigned DRAW_DEPTH = 10; // Deeper cells are smaller than a pixel
 static const qtree::Rect MAP_BOUNDS = { 0, 0, WIDTH, HEIGHT };
 
 using QueryRect = qtree::Rect;
@@ -42,6 +43,9 @@ int main()
     //    //m_quadtree->insert(point, qtree::Rect(x, y, 5, 5));
     //}
 
+    // All the outlines of a frame are accumulated here and drawn at once
+    sf::VertexArray batch(sf::Lines);
+
     while (window.isOpen())
     {
         sf::Event event;
@@ -66,44 +70,48 @@ int main()
             {
                 if (event.key.code == sf::Keyboard::R)
                 {
-                    auto found = m_quadtree->query(query);
-                    for (const auto& n : found)
+                    // Remove all the points found by the query in a single traversal
+                    m_quadtree->removeIf(query, [&](const qtree::Node<qtree::Point>& n)
                     {
-                        LOG_DEBUG("Found Node: " << n);
-                        auto point = n->data;
+                        auto point = n.data;
                         LOG_DEBUG("Found point: " << point);
-                        m_quadtree->remove(*n);
                         points.erase(std::find(points.begin(), points.end(), point));
-
-                    }
+                        return true;
+                    });
                 }
             }
         }
 
         window.clear();
+        batch.clear();
 
-        //Tell the quadtree how to draw itself in the window
-        m_quadtree->draw([&](const qtree::Rect& rect)
+        // Tell the quadtree how to draw its visible part in the window
+        const sf::View& view = window.getView();
+        qtree::Rect viewport(view.getCenter().x - view.getSize().x / 2, view.getCenter().y - view.getSize().y / 2,
+            view.getSize().x, view.getSize().y);
+        m_quadtree->draw(viewport, DRAW_DEPTH, [&](const qtree::Rect& rect)
         {
-            Utils::drawRectangle(window, rect, sf::Color::White);
+            Utils::drawRectangle(batch, rect, sf::Color::White);
         });
 
         // Draw points in quadtree
         for (const auto& p : points)
         {
-            Utils::drawCircle(window, qtree::Circle(p->x, p->y, 3), sf::Color::White);
+            Utils::drawCircle(batch, qtree::Circle(p->x, p->y, 3), sf::Color::White);
         }
 
         // draw query circle
-        Utils::drawCircle(window, query, sf::Color::Green);
+        Utils::drawCircle(batch, query, sf::Color::Green);
 
         // Draw found by the query points 
         auto found = m_quadtree->query(query);
         for (const auto& n : found)
         {
-            Utils::drawCircle(window, qtree::Circle(n->data->x, n->data->y, 3), sf::Color::Green);
+            Utils::drawCircle(batch, qtree::Circle(n->data->x, n->data->y, 3), sf::Color::Green);
         }
 
+        window.draw(batch);
+
         sf::Text text1("Press the left mouse button to place points in the scene", font, 20);
         text1.setPosition(10, 10);
         text1.setColor(sf::Color::White);
@@ -11,6 +11,7 @@
 
 static const int WIDTH = 800;
 static const int HEIGHT = 600;
+static const unsigned DRAW_DEPTH = 10; // Deeper cells are smaller than a pixel
 
 using QueryRect = qtree::Rect;
 
@@ -28,6 +29,9 @@ int main()
     std::vector<qtree::Point*> points;
     std::vector<qtree::Rect> bounds;
 
+    // All the outlines of a frame are accumulated here and drawn at once
+    sf::VertexArray batch(sf::Lines);
+
     while (window.isOpen())
     {
         sf::Event event;
@@ -56,30 +60,36 @@ int main()
         }
 
         window.clear();
+        batch.clear();
 
-        //Tell the quadtree how to draw itself in the window
-        m_quadtree->draw([&](const qtree::Rect& rect) 
-        { 
-            Utils::drawRectangle(window, rect, sf::Color::White);
+        // Tell the quadtree how to draw its visible part in the window
+        const sf::View& view = window.getView();
+        qtree::Rect viewport(view.getCenter().x - view.getSize().x / 2, view.getCenter().y - view.getSize().y / 2,
+            view.getSize().x, view.getSize().y);
+        m_quadtree->draw(viewport, DRAW_DEPTH, [&](const qtree::Rect& rect)
+        {
+            Utils::drawRectangle(batch, rect, sf::Color::White);
         });
 
         //Draw triangles placed in te scene
         for (size_t i=0; i<bounds.size(); i++)
         {
-            Utils::drawRectangle(window, bounds[i], sf::Color::White);
+            Utils::drawRectangle(batch, bounds[i], sf::Color::White);
         }
 
         // draw query rectangleRange
         QueryRect queryRange(200, 200, 200, 200);
-        Utils::drawRectangle(window, queryRange, sf::Color::Green);
+        Utils::drawRectangle(batch, queryRange, sf::Color::Green);
 
         // Draw found by query rectangles
         auto found = m_quadtree->query(queryRange);
         for (const auto& n : found)
         {
-            Utils::drawRectangle(window, n->bound, sf::Color::Green);
+            Utils::drawRectangle(batch, n->bound, sf::Color::Green);
         }
 
+        window.draw(batch);
+
         window.display();
     }
 
@@ -4,9 +4,23 @@
 // STL
 #include <vector>
 #include <unordered_set>
+#include <unordered_map>
+#include <array>
+#include <queue>
+#include <random>
 #include <algorithm>
 #include <functional>
 #include <memory>
+#include <limits>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <thread>
+#include <type_traits>
+#if __cplusplus >= 201703L
+#include <memory_resource>
+#endif
 
 #ifdef _DEBUG
 #define LOG_DEBUG(s) std::cout << "DEBUG | " << s << " | " __FUNCTION__ << std::endl;
@@ -18,26 +32,40 @@ namespace qtree
 {
     // Forward decleration
     struct Point;
-    struct Shape;
+    struct Point3;
     struct Rect;
+    struct Box;
     struct Circle;
-    template<typename T> class Node;
-    template<typename T> class QuadTree;
+    struct GeoCircle;
+    struct Sphere;
+    struct ConvexPolygon;
+    struct OrientedRect;
+    struct Frustum;
+    template<typename Bound> struct BasicShape;
+    template<unsigned D> struct Space;
+    class MemoryResource;
+    template<typename U> class Allocator;
+    template<typename T, unsigned D = 2> class Node;
+    template<typename T, unsigned D = 2> class QuadTree;
+    template<typename T, unsigned D = 2> class Snapshot;
 
-    /** \brief 
-     * Shape struct which represents a geometrical 2D shape
-     * 
+    /** \brief
+     * Shape struct which represents a geometrical shape
+     *
+     * The Bound is the axis aligned box type of the space the shape lives in (Rect in 2D, Box in 3D)
+     *
      */
-    struct Shape {
+    template<typename Bound>
+    struct BasicShape {
         /**
          * intersects
-         * 
+         *
          * Return if the given bound intersects with this Shape
-         * 
+         *
          * \param bound A rect object to check againts
          * \return True if intersects, False otherwise
          */
-        virtual bool intersects(const Rect& bound) const noexcept = 0;
+        virtual bool intersects(const Bound& bound) const noexcept = 0;
 
         /**
          * contains
@@ -47,9 +75,21 @@ namespace qtree
          * \param bound A rect object to check againts
          * \return True if contained, False otherwise
          */
-        virtual bool contains(const Rect& bound) const noexcept = 0;
+        virtual bool contains(const Bound& bound) const noexcept = 0;
     };
 
+    /** A geometrical 2D shape */
+    using Shape = BasicShape<Rect>;
+
+    /** A geometrical 3D shape */
+    using Shape3 = BasicShape<Box>;
+
+    /** Bitmask of the layers (categories) an object belongs to */
+    using Mask = std::uint32_t;
+
+    /** The mask of the objects inserted without layers, they belong to every layer */
+    constexpr Mask AllLayers = ~Mask(0);
+
 
     /** \brief
      * Point struct which represents a Point in a 2D space
@@ -62,6 +102,17 @@ namespace qtree
         double x, y;
     };
 
+    /** \brief
+     * Point3 struct which represents a Point in a 3D space
+     *
+     */
+    struct Point3 {
+        /** Constructor */
+        Point3(double x, double y, double z) : x(x), y(y), z(z) {};
+
+        double x, y, z;
+    };
+
     /** \brief
      * Circle struct which extends Shape, this struct represents a 2D Circle
      *
@@ -81,29 +132,102 @@ namespace qtree
         bool contains(const Rect& bound) const noexcept override;
 
         /** The Circle X coord, Center of the circle */
-        double x; 
+        double x;
 
         /**< The Circle Y coord, Center of the circle */
         double y;
         double radius;
     };
 
+    /** \brief
+     * GeoCircle struct which extends Shape, this struct represents a circle on the surface of a sphere
+     *
+     * In a geographic quadtree the X coord is the longitude and the Y coord is the latitude, both in degrees,
+     * the whole sphere is the Rect(-180, -90, 360, 180). Distances are great-circle distances, so the circle
+     * stays correct away from the equator, across the antimeridian and around the poles.
+     *
+     */
+    struct GeoCircle : public Shape
+    {
+        /** Mean radius of the Earth in meters */
+        static constexpr double EarthRadius = 6371008.8;
+
+        /** Constructor
+         *
+         * \param longitude     Longitude of the center in degrees
+         * \param latitude      Latitude of the center in degrees
+         * \param radius        Radius of the circle, in the unit of the sphere radius
+         * \param sphereRadius  Radius of the sphere (meters on the Earth by default)
+         */
+        GeoCircle(double longitude, double latitude, double radius, double sphereRadius = EarthRadius) :
+            longitude(longitude), latitude(latitude), radius(radius), sphereRadius(sphereRadius) {};
+
+        /** See delecration of Shape */
+        bool intersects(const Rect& bound) const noexcept override;
+
+        /** See delecration of Shape */
+        bool contains(const Rect& bound) const noexcept override;
+
+        /** Central angle in radians between two positions given in degrees (haversine formula) */
+        static double angle(double longitude1, double latitude1, double longitude2, double latitude2) noexcept;
+
+        /** Smallest central angle in radians between a position and a longitude/latitude rect */
+        static double minAngle(double longitude, double latitude, const Rect& bound) noexcept;
+
+        /** Largest central angle in radians between a position and a longitude/latitude rect */
+        static double maxAngle(double longitude, double latitude, const Rect& bound) noexcept;
+
+        double longitude;
+        double latitude;
+        double radius;
+        double sphereRadius;
+
+    private:
+        static void angles(double longitude, double latitude, const Rect& bound, bool farthest, double& result) noexcept;
+    };
+
+    /** \brief
+     * Sphere struct which extends Shape3, this struct represents a 3D Sphere
+     *
+     */
+    struct Sphere : public Shape3
+    {
+        /** Constructor */
+        Sphere(const Sphere& other) : x(other.x), y(other.y), z(other.z), radius(other.radius) {};
+
+        /** Constructor */
+        Sphere(double x, double y, double z, double radius) : x(x), y(y), z(z), radius(radius) {};
+
+        /** See delecration of Shape */
+        bool intersects(const Box& bound) const noexcept override;
+
+        /** See delecration of Shape */
+        bool contains(const Box& bound) const noexcept override;
+
+        /** The Sphere center */
+        double x, y, z;
+        double radius;
+    };
+
     /** \brief
      * Rect struct which extends Shape, this struct represents a 2D Rectangle
      *
      */
-    struct Rect : public Shape 
+    struct Rect : public Shape
     {
         /** Constructor */
-        Rect(const Rect& other) : Rect(other.x, other.y, other.width, other.height) 
+        Rect(const Rect& other) : Rect(other.x, other.y, other.width, other.height)
         {}
 
+        /** Assignment */
+        Rect& operator=(const Rect& other) = default;
+
         /** Constructor */
         Rect(double x, double y, double width, double height) :
             x(x),
             y(y),
             width(width),
-            height(height) 
+            height(height)
         {}
 
         /** See delecration of Shape */
@@ -115,302 +239,3494 @@ namespace qtree
         double x, y, width, height;
     };
 
+    /** \brief
+     * Box struct which extends Shape3, this struct represents a 3D axis aligned box
+     *
+     */
+    struct Box : public Shape3
+    {
+        /** Constructor */
+        Box(const Box& other) : Box(other.x, other.y, other.z, other.width, other.height, other.depth)
+        {}
+
+        /** Assignment */
+        Box& operator=(const Box& other) = default;
+
+        /** Constructor */
+        Box(double x, double y, double z, double width, double height, double depth) :
+            x(x),
+            y(y),
+            z(z),
+            width(width),
+            height(height),
+            depth(depth)
+        {}
+
+        /** See delecration of Shape */
+        bool intersects(const Box& other) const noexcept override;
+
+        /** See delecration of Shape */
+        bool contains(const Box& other) const noexcept override;
+
+        double x, y, z, width, height, depth;
+    };
+
+    /** \brief
+     * ConvexPolygon struct which extends Shape, this struct represents a 2D convex polygon
+     *
+     * The edge normals are computed once on construction, cells are classified against the polygon
+     * using the separating axis theorem so cells fully inside the polygon are accepted as a whole.
+     *
+     */
+    struct ConvexPolygon : public Shape
+    {
+        /** Constructor, the vertices may be given in either winding order */
+        ConvexPolygon(std::vector<Point> vertices);
+
+        /** See delecration of Shape */
+        bool intersects(const Rect& bound) const noexcept override;
+
+        /** See delecration of Shape */
+        bool contains(const Rect& bound) const noexcept override;
+
+        /** The polygon vertices in counter clockwise order */
+        const std::vector<Point>& vertices() const noexcept { return m_vertices; }
+
+    private:
+        // Every point p inside the polygon satisfies nx * p.x + ny * p.y <= offset for all the edges
+        struct Edge {
+            double nx, ny, offset;
+        };
+
+        std::vector<Point> m_vertices;
+        std::vector<Edge>  m_edges;
+        double m_minX, m_minY, m_maxX, m_maxY;
+    };
+
+    /** \brief
+     * OrientedRect struct which extends ConvexPolygon, this struct represents a 2D rectangle rotated around its center
+     *
+     */
+    struct OrientedRect : public ConvexPolygon
+    {
+        /** Constructor
+         *
+         * \param x         The rectangle center X coord
+         * \param y         The rectangle center Y coord
+         * \param width     The rectangle width before the rotation
+         * \param height    The rectangle height before the rotation
+         * \param angle     The rotation in radians
+         */
+        OrientedRect(double x, double y, double width, double height, double angle);
+
+        double x, y, width, height, angle;
+
+    private:
+        static std::vector<Point> corners(double x, double y, double width, double height, double angle);
+    };
+
+    /** \brief
+     * Frustum struct which extends ConvexPolygon, this struct represents a 2D view frustum
+     *
+     * The frustum is the trapezoid seen by a camera at the eye position, between the near and the far distances
+     *
+     */
+    struct Frustum : public ConvexPolygon
+    {
+        /** Constructor
+         *
+         * \param x         The eye X coord
+         * \param y         The eye Y coord
+         * \param direction The view direction in radians
+         * \param fov       The full field of view angle in radians, must be smaller than PI
+         * \param nearPlane The distance from the eye to the near edge
+         * \param farPlane  The distance from the eye to the far edge
+         */
+        Frustum(double x, double y, double direction, double fov, double nearPlane, double farPlane);
+
+        double x, y, direction, fov, nearPlane, farPlane;
+
+    private:
+        static std::vector<Point> corners(double x, double y, double direction, double fov, double nearPlane, double farPlane);
+    };
+
+    /** \brief
+     * Describes the geometry types of a D dimensional space
+     *
+     * The tree only accesses its bounds through this struct, which is what allows a single
+     * implementation to serve as a quadtree (D = 2) and as an octree (D = 3)
+     *
+     */
+    template<> struct Space<2> {
+        using Point = qtree::Point;
+        using Bound = Rect;
+        using Shape = qtree::Shape;
+
+        /** The lower coordinate of the bound on the given axis */
+        static double lower(const Rect& bound, unsigned axis) noexcept { return axis == 0 ? bound.x : bound.y; }
+
+        /** The size of the bound on the given axis */
+        static double extent(const Rect& bound, unsigned axis) noexcept { return axis == 0 ? bound.width : bound.height; }
+
+        /** The coordinate of the point on the given axis */
+        static double coord(const Point& point, unsigned axis) noexcept { return axis == 0 ? point.x : point.y; }
+
+        /** Build a bound from its lower coordinates and its size */
+        static Rect bound(const double* lower, const double* extent) { return Rect(lower[0], lower[1], extent[0], extent[1]); }
+
+        /** The bound used for objects inserted as points */
+        static Rect bound(const Point& point) { return Rect(point.x, point.y, 1, 1); }
+    };
+
+    /** See Space<2> */
+    template<> struct Space<3> {
+        using Point = Point3;
+        using Bound = Box;
+        using Shape = Shape3;
+
+        /** The lower coordinate of the bound on the given axis */
+        static double lower(const Box& bound, unsigned axis) noexcept { return axis == 0 ? bound.x : axis == 1 ? bound.y : bound.z; }
+
+        /** The size of the bound on the given axis */
+        static double extent(const Box& bound, unsigned axis) noexcept { return axis == 0 ? bound.width : axis == 1 ? bound.height : bound.depth; }
+
+        /** The coordinate of the point on the given axis */
+        static double coord(const Point& point, unsigned axis) noexcept { return axis == 0 ? point.x : axis == 1 ? point.y : point.z; }
+
+        /** Build a bound from its lower coordinates and its size */
+        static Box bound(const double* lower, const double* extent) { return Box(lower[0], lower[1], lower[2], extent[0], extent[1], extent[2]); }
+
+        /** The bound used for objects inserted as points */
+        static Box bound(const Point& point) { return Box(point.x, point.y, point.z, 1, 1, 1); }
+    };
+
+    /** \brief
+     * Source of all the memory used by the quadtree, it follows the contract of std::pmr::memory_resource
+     *
+     * The quadtree cells, nodes and buckets are all allocated from the resource given to the quadtree,
+     * which allows backing a tree with an arena (see MonotonicResource) or a thread local pool.
+     * Only the bookkeeping the root keeps across QuadTree::release() (caches, pairs, observers, its own summary) uses the global heap.
+     *
+     */
+    class MemoryResource {
+    public:
+        virtual ~MemoryResource() = default;
+
+        /** Allocate at least bytes of memory aligned to alignment */
+        void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t)) { return doAllocate(bytes, alignment); }
+
+        /** Return memory previously given by allocate with the same bytes and alignment */
+        void deallocate(void* p, size_t bytes, size_t alignment = alignof(std::max_align_t)) { doDeallocate(p, bytes, alignment); }
+
+        /**
+         * isMonotonic
+         *
+         * \return True if deallocate does nothing and the memory is only reclaimed when the resource is released,
+         *         which lets QuadTree::release() drop a whole tree without visiting it
+         */
+        virtual bool isMonotonic() const noexcept { return false; }
+
+    protected:
+        virtual void* doAllocate(size_t bytes, size_t alignment) = 0;
+        virtual void doDeallocate(void* p, size_t bytes, size_t alignment) = 0;
+    };
+
+    /** \brief
+     * Memory resource using the global new and delete
+     *
+     */
+    class NewDeleteResource : public MemoryResource {
+    protected:
+        void* doAllocate(size_t bytes, size_t) override { return ::operator new(bytes); }
+        void doDeallocate(void* p, size_t, size_t) override { ::operator delete(p); }
+    };
+
+    /** defaultResource
+     *
+     * \return The memory resource used by quadtrees that were not given one
+     */
+    inline MemoryResource* defaultResource() noexcept
+    {
+        static NewDeleteResource resource;
+        return &resource;
+    }
+
+    /** \brief
+     * Arena memory resource, memory is handed out from chunks that are only freed all at once
+     *
+     * Deallocation does nothing, release() (or destroying the resource) frees all the memory at once.
+     * Chunks double in size up to MaxChunkSize (or the initial chunk size when it is bigger),
+     * and release() starts over from the initial chunk size so an arena can be reused every frame.
+     * Not thread safe, use one arena per thread.
+     *
+     */
+    class MonotonicResource : public MemoryResource {
+    public:
+        /** Size above which chunks stop growing */
+        static constexpr size_t MaxChunkSize = 16 * 1024 * 1024;
+
+        /** Constructor */
+        explicit MonotonicResource(size_t chunkSize = 64 * 1024, MemoryResource* upstream = defaultResource()) :
+            m_initialChunkSize(chunkSize),
+            m_chunkSize(chunkSize),
+            m_upstream(upstream) {}
+
+        MonotonicResource(const MonotonicResource&) = delete;
+        MonotonicResource& operator=(const MonotonicResource&) = delete;
+
+        ~MonotonicResource() { release(); }
+
+        /** release
+         *
+         * Free all the memory handed out by the arena, everything allocated from it must not be used anymore
+         */
+        void release() noexcept
+        {
+            while (m_chunks)
+            {
+                Chunk* next = m_chunks->next;
+                m_upstream->deallocate(m_chunks, m_chunks->size);
+                m_chunks = next;
+            }
+            m_current = m_end = nullptr;
+            m_chunkSize = m_initialChunkSize;
+        }
+
+        bool isMonotonic() const noexcept override { return true; }
+
+    protected:
+        void* doAllocate(size_t bytes, size_t alignment) override
+        {
+            void* p = m_current;
+            size_t space = m_end - m_current;
+            if (!m_current || !std::align(alignment, bytes, p, space))
+            {
+                // Chunks grow geometrically so big trees need few of them
+                size_t size = std::max(m_chunkSize, bytes + alignment + sizeof(Chunk));
+                m_chunkSize = std::min(m_chunkSize * 2, std::max(m_initialChunkSize, size_t(MaxChunkSize)));
+
+                Chunk* chunk = static_cast<Chunk*>(m_upstream->allocate(size));
+                chunk->next = m_chunks;
+                chunk->size = size;
+                m_chunks = chunk;
+                m_current = reinterpret_cast<char*>(chunk + 1);
+                m_end = reinterpret_cast<char*>(chunk) + size;
+
+                p = m_current;
+                space = m_end - m_current;
+                std::align(alignment, bytes, p, space);
+            }
+
+            m_current = static_cast<char*>(p) + bytes;
+            return p;
+        }
+
+        void doDeallocate(void*, size_t, size_t) override {}
+
+    private:
+        struct Chunk {
+            Chunk* next;
+            size_t size;
+        };
+
+        size_t          m_initialChunkSize;
+        size_t          m_chunkSize;
+        MemoryResource* m_upstream;
+        Chunk*          m_chunks = nullptr;
+        char*           m_current = nullptr;
+        char*           m_end = nullptr;
+    };
+
+#if __cplusplus >= 201703L
+    /** \brief
+     * Adapts a std::pmr::memory_resource so it can back a quadtree
+     *
+     */
+    class PmrResource : public MemoryResource {
+    public:
+        /** Constructor */
+        explicit PmrResource(std::pmr::memory_resource* resource, bool monotonic = false) :
+            m_resource(resource),
+            m_monotonic(monotonic) {}
+
+        bool isMonotonic() const noexcept override { return m_monotonic; }
+
+    protected:
+        void* doAllocate(size_t bytes, size_t alignment) override { return m_resource->allocate(bytes, alignment); }
+        void doDeallocate(void* p, size_t bytes, size_t alignment) override { m_resource->deallocate(p, bytes, alignment); }
+
+    private:
+        std::pmr::memory_resource* m_resource;
+        bool m_monotonic;
+    };
+#endif
+
+    /** \brief
+     * Standard allocator handing out memory from a MemoryResource, used for the containers of the quadtree
+     *
+     */
+    template<typename U>
+    class Allocator {
+    public:
+        using value_type = U;
+
+        /** Constructor */
+        Allocator(MemoryResource* resource = defaultResource()) noexcept : m_resource(resource) {}
+
+        /** Constructor */
+        template<typename V>
+        Allocator(const Allocator<V>& other) noexcept : m_resource(other.resource()) {}
+
+        U* allocate(size_t n) { return static_cast<U*>(m_resource->allocate(n * sizeof(U), alignof(U))); }
+        void deallocate(U* p, size_t n) noexcept { m_resource->deallocate(p, n * sizeof(U), alignof(U)); }
+
+        MemoryResource* resource() const noexcept { return m_resource; }
+
+        template<typename V>
+        bool operator==(const Allocator<V>& other) const noexcept { return m_resource == other.resource(); }
+
+        template<typename V>
+        bool operator!=(const Allocator<V>& other) const noexcept { return m_resource != other.resource(); }
+
+    private:
+        MemoryResource* m_resource;
+    };
+
     /** \Brief
      * The main object used by the quad tree to handle data
-     * 
-     * The main object used by the quad tree to handle data, it contains a pointer to the data and a bound 
-     * object which is the object bound representation in the 2D space
-     * 
+     *
+     * The main object used by the quad tree to handle data, it contains a pointer to the data and a bound
+     * object which is the object bound representation in the space
+     *
      */
-    template<typename T>
+    template<typename T, unsigned D>
     class Node {
-        
+
     public:
+        using Bound = typename Space<D>::Bound;
+
         /** Constructor */
-        Node(T* data = {}, const Rect& bound = {}) :
+        Node(T* data = {}, const Bound& bound = {}, MemoryResource* resource = defaultResource(), Mask mask = AllLayers) :
             data(data),
-            bound(bound) {};
+            bound(bound),
+            mask(mask),
+            qt(Allocator<QuadTree<T, D>*>(resource)) {};
 
     public:
         T* data = nullptr;
-        Rect bound;
+        Bound bound;
+        Mask mask = AllLayers; // Layers of the object, given on insertion
+        double score = 0;      // Given by the score function of the quadtree, see QuadTree::setScore
+        std::array<double, D> velocity{}; // The bound moves by velocity per unit of time, see QuadTree::setMoving
+        double time = 0;                  // The time at which the object is at its bound
 
     private:
-        friend class QuadTree<T>;
-        std::vector<QuadTree<T>*> qt;
+        friend class QuadTree<T, D>;
+        std::vector<QuadTree<T, D>*, Allocator<QuadTree<T, D>*>> qt;
+        bool dead = false; // Removed while removal was deferred, waiting for compact()
     };
 
 
     /** \brief
      * Quadtree data structure
      *
-     * A quadtree is a tree data structure in which each internal node has exactly four children. 
-     * Quadtrees are the two-dimensional analog of octrees and are most often used to partition 
-     * a two-dimensional space by recursively subdividing it into four quadrants or regions. 
-     * The data associated with a leaf cell varies by application, 
+     * A quadtree is a tree data structure in which each internal node has exactly four children.
+     * Quadtrees are the two-dimensional analog of octrees and are most often used to partition
+     * a two-dimensional space by recursively subdividing it into four quadrants or regions.
+     * The data associated with a leaf cell varies by application,
      * but the leaf cell represents a "unit of interesting spatial information".
-     * 
+     *
      * From Wikipedia, the free encyclopedia
      *
+     * The tree is templated on the dimension D of the space, every cell has 2^D children,
+     * QuadTree<T> is the 2D quadtree and QuadTree<T, 3> (see Octree) is its 3D analog.
+     *
      */
-    template<typename T>
+    template<typename T, unsigned D>
     class QuadTree {
     public:
-        /** Constructor */
-        QuadTree(const Rect& bound, unsigned capacity);
+        using Point = typename Space<D>::Point;
+        using Bound = typename Space<D>::Bound;
+        using Shape = typename Space<D>::Shape;
+
+        /** Amount of children of every subdivided cell */
+        static constexpr unsigned Children = 1u << D;
+
+        /** Displacement per unit of time on every axis */
+        using Velocity = std::array<double, D>;
+
+        /** Constructor
+         *
+         * \param bound     The area covered by the quadtree
+         * \param capacity  Amount of objects a cell holds before it is subdivided
+         * \param resource  Source of all the memory of the quadtree, must outlive it
+         */
+        QuadTree(const Bound& bound, unsigned capacity, MemoryResource* resource = defaultResource());
 
         /** Copy Constructor */
-        QuadTree(const QuadTree& other) : QuadTree(other.m_bounds, other.m_capacity) { }
+        QuadTree(const QuadTree& other) : QuadTree(other.m_bounds, other.m_capacity, other.m_resource) { }
+
+        /** insert
+         *
+         *  Insert an object into the quadtree
+         *
+         *  \param obj      object to insert into the quadtree
+         *  \param point    the object position in the scene
+         *
+         *  \return     True or false wether the insertion was successful
+         */
+        inline bool insert(T& obj, const Point& point){ return insert(obj, pointBound(point)); }
 
         /** insert
          *
-         *  Insert an object into the quadtree 
-         * 
+         *  Insert an object which belongs to the given layers into the quadtree
+         *
          *  \param obj      object to insert into the quadtree
          *  \param point    the object position in the scene
-         * 
+         *  \param mask     the layers of the object
+         *
          *  \return     True or false wether the insertion was successful
          */
-        inline bool insert(T& obj, const Point& point){ return insert(obj, Rect(point.x, point.y, 1, 1)); }
+        inline bool insert(T& obj, const Point& point, Mask mask){ return insert(obj, pointBound(point), mask); }
 
         /** insert
-         * 
-         * Insert an object into the quadtree 
-         * 
+         *
+         * Insert an object into the quadtree
+         *
          * \param obj   object to insert into the quadtree
          * \param x     object X coordinate
          * \param y     object Y coordinate
          * \return      True or false wether the insertion was successful
          */
+        template<unsigned Dimension = D, typename = std::enable_if_t<Dimension == 2>>
         inline bool insert(T& obj, double x, double y){ return insert(obj, Point(x, y)); }
 
         /** insert
-         * 
-         * Insert an object into the quadtree 
-         * 
+         *
+         * Insert an object into the octree
+         *
+         * \param obj   object to insert into the octree
+         * \param x     object X coordinate
+         * \param y     object Y coordinate
+         * \param z     object Z coordinate
+         * \return      True or false wether the insertion was successful
+         */
+        template<unsigned Dimension = D, typename = std::enable_if_t<Dimension == 3>>
+        inline bool insert(T& obj, double x, double y, double z){ return insert(obj, Point(x, y, z)); }
+
+        /** insert
+         *
+         * Insert an object into the quadtree
+         *
          * \param obj       object to insert into the quadtree
          * \param bound     object's bound in space
          * \return          True or false wether the insertion was successful
          */
-        inline bool insert(T& obj, const Rect& bound){ return insert(std::make_shared<Node<T>>(&obj, bound)); }
-        
-        /** remove
-         * 
-         * Remove an element from the quadtree
-         * 
+        inline bool insert(T& obj, const Bound& bound)
+        {
+            return insert(std::allocate_shared<Node<T, D>>(Allocator<Node<T, D>>(m_resource), &obj, bound, m_resource));
+        }
+
+        /** insert
+         *
+         * Insert an object which belongs to the given layers into the quadtree
+         *
+         * \param obj       object to insert into the quadtree
+         * \param bound     object's bound in space
+         * \param mask      the layers of the object
+         * \return          True or false wether the insertion was successful
+         */
+        inline bool insert(T& obj, const Bound& bound, Mask mask)
+        {
+            return insert(std::allocate_shared<Node<T, D>>(Allocator<Node<T, D>>(m_resource), &obj, bound, m_resource, mask));
+        }
+
+        /** insert
+         *
+         * Insert a moving object into the quadtree, see setMoving
+         *
+         * \param obj       object to insert into the quadtree
+         * \param bound     object's bound in space at the given time
+         * \param velocity  the displacement of the object per unit of time
+         * \param time      the time at which the object is at its bound
+         * \return          True or false wether the insertion was successful
+         */
+        inline bool insert(T& obj, const Bound& bound, const Velocity& velocity, double time)
+        {
+            auto node = std::allocate_shared<Node<T, D>>(Allocator<Node<T, D>>(m_resource), &obj, bound, m_resource);
+            node->velocity = velocity;
+            node->time = time;
+            return insert(node);
+        }
+
+        /** remove
+         *
+         * Remove an element from the quadtree
+         *
          * \param node  The node to be removed from the quadtree
          * \return True or false wether the removal was successful
          */
-        bool remove(const Node<T>& node);
+        bool remove(const Node<T, D>& node);
+
+        /** move
+         *
+         * Move an object to a new bound. The node keeps its identity, it is only relinked to the leaves
+         * of the new bound, or updated in place when it stays inside its only leaf.
+         * An object moved outside of the quadtree is removed.
+         *
+         * \param node      The node to be moved
+         * \param bound     The new bound of the object
+         * \return          True or false wether the object is still in the quadtree
+         */
+        bool move(const Node<T, D>& node, const Bound& bound);
+
+        /** move
+         *
+         * Change the trajectory of a moving object, see setMoving and move
+         *
+         * \param node      The node to be moved
+         * \param bound     The bound of the object at the given time
+         * \param velocity  The new displacement of the object per unit of time
+         * \param time      The time at which the object is at its bound
+         * \return          True or false wether the object is still in the quadtree
+         */
+        bool move(const Node<T, D>& node, const Bound& bound, const Velocity& velocity, double time);
+
+        /** removeIf
+         *
+         * Remove all the objects with a bound that intersects the given range and satisfy the predicate,
+         * in a single traversal. Every touched bucket is compacted once and cells are merged once at the end
+         * (or by the next compact() when removal is deferred).
+         * The predicate is called once per object in range, even for objects split between cells.
+         *
+         * Example usage:
+         * removeIf(circle, [](const Node<T>& node){ return node.data->health <= 0; })
+         *
+         * \param range         A shape that will be used to find the objects to remove
+         * \param predicate     A callback that accepts a Node and returns True if it should be removed
+         * \return              The amount of removed objects
+         */
+        template<typename Predicate>
+        size_t removeIf(const Shape& range, Predicate&& predicate);
+
+        /** eraseRange
+         *
+         * Remove all the objects with a bound that intersects the given range, see removeIf
+         *
+         * \param range     A shape that will be used to find the objects to remove
+         * \return          The amount of removed objects
+         */
+        inline size_t eraseRange(const Shape& range) { return removeIf(range, [](const Node<T, D>&) { return true; }); }
+
+        /** A pair of objects with intersecting bounds, the first node has the lower address */
+        struct Pair {
+            const Node<T, D>* first;
+            const Node<T, D>* second;
+        };
+
+        /** The pairs which started and stopped overlapping since the previous updatePairs() */
+        struct PairEvents {
+            std::vector<Pair> begin;
+            std::vector<Pair> end;
+        };
+
+        /** setPairTracking
+         *
+         * Maintain the set of overlapping pairs of objects (a broadphase). While enabled the inserted, moved
+         * and removed objects are recorded, and updatePairs() brings the pairs up to date from those objects only.
+         * The pairs of the objects already in the quadtree are reported by the first updatePairs().
+         * Toroidal quadtrees also pair the objects overlapping across the opposite edges.
+         * clear() and release() drop the pairs without reporting them.
+         *
+         * \param tracking  True to maintain the overlapping pairs
+         */
+        void setPairTracking(bool tracking);
+
+        /** updatePairs
+         *
+         * Find the pairs which started or stopped overlapping since the previous call, each with a query
+         * around one of the objects inserted, moved or removed since then.
+         * The nodes of the ended pairs stay valid until the next call, even if they were removed.
+         *
+         * \return  The begin and end events of the pairs
+         */
+        PairEvents updatePairs();
+
+        /** forEachPair
+         *
+         * Call the given function with every pair of overlapping objects as of the last updatePairs()
+         *
+         * \param func  A callback that accepts the two nodes of a pair
+         */
+        template<typename Func>
+        void forEachPair(Func&& func) const;
+
+        /** An object which entered or left the region of an observer */
+        struct Visibility {
+            size_t observer;
+            const Node<T, D>* node;
+        };
+
+        /** The objects which entered and left the regions of the observers since the previous updateSubscriptions() */
+        struct VisibilityEvents {
+            std::vector<Visibility> enter;
+            std::vector<Visibility> leave;
+        };
+
+        /** subscribe
+         *
+         * Register an observer of the objects which intersect a region (an area of interest).
+         * The objects already in the region enter it on the next updateSubscriptions().
+         * The regions are kept in their own quadtree, so an object finds the observers that see it with a single query.
+         *
+         * \param region    The region seen by the observer, it should intersect the bounds of the quadtree
+         * \return          The id of the observer
+         */
+        size_t subscribe(const Bound& region);
+
+        /** setRegion
+         *
+         * Move the region of an observer, the difference is reported by the next updateSubscriptions()
+         *
+         * \param observer  The id returned by subscribe
+         * \param region    The new region seen by the observer
+         */
+        void setRegion(size_t observer, const Bound& region);
+
+        /** unsubscribe
+         *
+         * Forget an observer, without reporting the objects leaving its region
+         *
+         * \param observer  The id returned by subscribe
+         */
+        void unsubscribe(size_t observer);
+
+        /** updateSubscriptions
+         *
+         * Find the objects which entered or left the region of each observer since the previous call.
+         * Only the objects inserted, moved or removed since then and the observers which moved are looked at.
+         * The nodes which left stay valid until the next call, even if they were removed.
+         * clear() and release() empty the regions without reporting it.
+         *
+         * \return  The enter and leave events of the observers
+         */
+        VisibilityEvents updateSubscriptions();
+
+        /** visible
+         *
+         * \param observer  The id returned by subscribe
+         * \return          The objects in the region of the observer as of the last updateSubscriptions()
+         */
+        const std::unordered_set<const Node<T, D>*>& visible(size_t observer) const { return m_state->observers.at(observer).visible; }
+
+        /** setMergeThreshold
+         *
+         * Set the amount of objects under which a subdivided cell is merged back into a single leaf,
+         * the gap between it and the capacity (which triggers a split) is the hysteresis that keeps
+         * objects jittering around a cell boundary from repeatedly splitting and merging the cell.
+         * The threshold is capped at the capacity, half the capacity is a good start.
+         * The default is 0: only empty subtrees are merged, as they always are whatever the threshold.
+         *
+         * \param threshold     Subtrees holding less objects than this are merged
+         */
+        void setMergeThreshold(unsigned threshold) noexcept;
+
+        /** setAutoGrow
+         *
+         * When auto grow is on, inserting an object outside of the quadtree bounds doubles the bounds towards the object
+         * (as many times as needed) instead of failing. The existing cells are attached as a child of the grown root
+         * as they are, no object is reinserted. This allows starting with bounds that tightly fit the initial data.
+         * Growing invalidates cursors.
+         *
+         * \param autoGrow  True to grow the quadtree when inserting outside of its bounds
+         */
+        inline void setAutoGrow(bool autoGrow) noexcept { m_autoGrow = autoGrow; }
+
+        /** setToroidal
+         *
+         * In a toroidal quadtree the space wraps around, on every axis the bounds of the quadtree are the period.
+         * query() finds the objects near the opposite edges in a single traversal, and nearest() uses wrap-around distances.
+         * cachedQuery(), cursor(), topK(), sample() and removeIf() wrap around the same way.
+         * Objects are expected to be inserted inside the bounds, auto grow should not be used with a toroidal quadtree.
+         *
+         * \param toroidal  True to wrap the space around
+         */
+        inline void setToroidal(bool toroidal) noexcept { m_toroidal = toroidal; clearQueryCache(); }
+
+        /** setGeographic
+         *
+         * A geographic quadtree indexes longitude/latitude positions in degrees (see GeoCircle), its bounds should be Rect(-180, -90, 360, 180).
+         * Points are inserted as zero sized bounds, nearest() ranks objects by great-circle distance and GeoCircle queries the objects within a radius.
+         * Only 2D quadtrees can be geographic and a geographic quadtree should not be toroidal.
+         *
+         * \param geographic    True to index longitude/latitude positions
+         */
+        inline void setGeographic(bool geographic) noexcept { m_geographic = geographic; }
+
+        /** setMoving
+         *
+         * In a moving quadtree the objects follow their velocity (see Node::velocity), so that queryAt() finds where they
+         * will be at any time without reinserting them. The objects stay in the cells of the bound they were inserted with,
+         * and every cell keeps a bound of its subtree which expands with the lowest and highest velocities of its objects.
+         * The expanding bounds loosen as the queried time gets away from their reference time, tighten() brings the
+         * objects and the bounds to a new time every now and then. A moving quadtree should not be toroidal or geographic.
+         *
+         * \param moving    True to maintain the expanding bounds of the cells
+         * \param time      The reference time of the expanding bounds
+         */
+        void setMoving(bool moving, double time = 0);
+
+        /** tighten
+         *
+         * Move every object to its bound at the given time, relinking it to the cells of its new position,
+         * and rebuild the expanding bounds of the cells from that time. Objects moving outside of the quadtree
+         * are removed, like with move(), unless auto grow is on.
+         *
+         * \param time      The new reference time, usually the current time
+         */
+        void tighten(double time);
+
+        /** predict
+         *
+         * \param node      A moving object
+         * \param time      The time to predict
+         * \return          The bound of the object at the given time
+         */
+        static Bound predict(const Node<T, D>& node, double time);
+
+        /** setDeferredRemoval
+         *
+         * When removal is deferred, remove() only marks the node as dead, queries skip dead nodes
+         * and the nodes are erased from their buckets and the cells are merged by the next call to compact().
+         * Turning deferred removal off compacts the quadtree.
+         *
+         * \param deferred  True to defer removals until compact() is called
+         */
+        void setDeferredRemoval(bool deferred);
+
+        /** compact
+         *
+         * Erase all the dead nodes from their buckets and merge the cells that fell below the merge threshold,
+         * in a single pass. Should be called at a quiet point of the frame when removal is deferred.
+         */
+        void compact();
+
+        /** query
+         *
+         * Query the Quadtree with a given range, this will return all the objects in the quadtree with a bound that intersects the given range
+         *
+         * \param range     A shape that will be used to query the Quadtree
+         * \return          A set of unique elements which their bound intersects the given range
+         */
+        inline std::unordered_set<const Node<T, D>*> query(const Shape& range);
+
+        /** query
+         *
+         * Query the Quadtree with a given range, only the objects which belong to one of the given layers are returned.
+         * Every cell knows the layers found in its subtree, the subtrees without any of the layers are skipped.
+         *
+         * \param range     A shape that will be used to query the Quadtree
+         * \param mask      The layers to look for
+         * \return          A set of unique elements which their bound intersects the given range
+         */
+        inline std::unordered_set<const Node<T, D>*> query(const Shape& range, Mask mask);
+
+        /** queryAt
+         *
+         * Query the moving objects where they will be (or were) at the given time, see setMoving.
+         * The cells whose expanding bound at that time misses the range are skipped.
+         *
+         * \param range     A shape that will be used to query the Quadtree
+         * \param time      The time at which the objects are looked for
+         * \return          A set of unique elements which their bound at that time intersects the given range
+         */
+        std::unordered_set<const Node<T, D>*> queryAt(const Shape& range, double time) const;
+
+        /** nearest
+         *
+         * Find the k objects closest to the given point, the distance to an object is the distance to the closest point of its bound.
+         * Cells are visited closest first and the search stops once no remaining cell can hold a closer object.
+         *
+         * \param point     The point to search around
+         * \param k         Amount of objects to find
+         * \return          Up to k nodes sorted from the closest
+         */
+        std::vector<const Node<T, D>*> nearest(const Point& point, size_t k = 1) const { return nearest(point, k, 0); }
+
+        /** nearest
+         *
+         * Find k objects approximately closest to the given point: the cells which could only improve the kth distance
+         * by a factor of (1 + epsilon) are skipped, so the kth object found is at most (1 + epsilon) times farther than
+         * the exact kth nearest. The search also stops once it visited the given amount of cells.
+         *
+         * \param point     The point to search around
+         * \param k         Amount of objects to find
+         * \param epsilon   The relative error allowed on the distances
+         * \param budget    Maximum amount of cells to visit, the best objects found by then are returned
+         * \return          Up to k nodes sorted from the closest
+         */
+        std::vector<const Node<T, D>*> nearest(const Point& point, size_t k, double epsilon, size_t budget = std::numeric_limits<size_t>::max()) const;
+
+        /** setScore
+         *
+         * Rank the objects by a score (a priority, a value, a threat...). Every cell keeps the highest score of the live objects
+         * in its subtree, which topK() uses to skip the cells that cannot hold a better object. An object is scored when it is
+         * inserted or moved, rescore() scores it again after its score changed. Setting the function scores the objects already
+         * in the quadtree, an empty function scores every object 0.
+         *
+         * \param score     A callback that accepts an object and returns its score
+         */
+        void setScore(std::function<double(const T&)> score);
+
+        /** rescore
+         *
+         * Score an object again, after the value its score is computed from changed
+         *
+         * \param node      The node to score
+         */
+        void rescore(const Node<T, D>& node);
+
+        /** topK
+         *
+         * Find the k objects with the highest scores (see setScore) among the objects with a bound that intersects the range.
+         * Cells are visited highest score first and the search stops once no remaining cell can hold an object scoring above the kth best.
+         *
+         * \param range     A shape that will be used to find the objects to rank
+         * \param k         Amount of objects to find
+         * \return          Up to k nodes sorted from the highest score
+         */
+        std::vector<const Node<T, D>*> topK(const Shape& range, size_t k) const;
+
+        /** sample
+         *
+         * Draw k distinct objects uniformly at random among the objects with a bound that intersects the range,
+         * without collecting all of them. Only the cells crossing the border of the range are weighted one by one,
+         * the cells inside it are weighted by their counts, and every draw descends from the root picking children
+         * in proportion to their weights. A draw landing on an object outside of the range is rejected, and an object
+         * split between cells is kept with the inverse of the amount of its buckets met by the range, so that every
+         * object is equally likely. When draws keep being rejected the matches are collected and sampled instead.
+         * In toroidal mode the range wraps around the edges like in query.
+         *
+         * \param range     A shape that will be used to find the objects to draw from
+         * \param k         Amount of objects to draw, all the matches are returned when there are fewer
+         * \param rng       A uniform random bit generator, such as std::mt19937
+         * \return          The drawn nodes
+         */
+        template<typename Generator>
+        std::vector<const Node<T, D>*> sample(const Shape& range, size_t k, Generator& rng);
+
+        /** The neighbours of every object in compressed sparse rows */
+        struct NeighbourLists {
+            std::vector<const Node<T, D>*> nodes; // The object of every row, grouped by the cell holding it
+            std::vector<size_t> offsets;          // The neighbours of nodes[i] are indices[offsets[i]] up to indices[offsets[i + 1]]
+            std::vector<size_t> indices;          // Indices into nodes, sorted within every row
+        };
+
+        /** buildNeighbourLists
+         *
+         * Find, for every object, the other objects whose bound center lies within the radius of its own center
+         * (wrapping around in toroidal mode). Instead of a query per object, every cell gathers the candidates
+         * around all of its objects with a single query, and the cells can be split between several threads.
+         *
+         * \param radius    The distance between the centers of two neighbours
+         * \param threads   Amount of threads building the lists
+         * \return          The neighbour lists of all the objects
+         */
+        NeighbourLists buildNeighbourLists(double radius, unsigned threads = 1);
+
+        /** The result of a density clustering */
+        struct Clustering {
+            std::vector<const Node<T, D>*> nodes; // The clustered objects, grouped by the cell holding them
+            std::vector<int> labels;              // The cluster of nodes[i], numbered from 0, or -1 for noise
+            size_t clusters = 0;                  // Amount of clusters
+        };
+
+        /** dbscan
+         *
+         * Cluster the objects by density (DBSCAN), with the distance between the centers of their bounds.
+         * An object with at least minPoints objects (itself included) within eps is a core object, the core objects
+         * within eps of each other share a cluster and the other objects join the cluster of a core object near them.
+         *
+         * The neighbours are gathered with a query per cell, and the cells whose objects all lie within eps of each other
+         * and are at least minPoints are dense: their objects are core and joined without any distance test.
+         * The cells can be split between several threads, each builds its own forest of clusters which are merged at the end.
+         *
+         * \param eps       The neighbourhood radius
+         * \param minPoints The amount of objects which make a neighbourhood dense
+         * \param threads   Amount of threads clustering
+         * \return          The cluster of every object
+         */
+        Clustering dbscan(double eps, size_t minPoints, unsigned threads = 1);
+
+        /** cachedQuery
+         *
+         * Query the Quadtree with a given rectangle and remember the result. While none of the cells the query touched
+         * change, issuing the same query again returns the remembered result without traversing the quadtree.
+         * Every cell counts its modifications, so a change elsewhere in the quadtree does not invalidate the result.
+         *
+         * \param range     A rectangle that will be used to query the Quadtree
+         * \return          A set of unique elements which their bound intersects the given range,
+         *                  valid until the next call to cachedQuery or clearQueryCache
+         */
+        const std::unordered_set<const Node<T, D>*>& cachedQuery(const Bound& range);
+
+        /** setQueryCacheSize
+         *
+         * Set the amount of different ranges cachedQuery remembers, once exceeded the cache is cleared (default 64)
+         *
+         * \param size      Maximum amount of cached ranges
+         */
+        inline void setQueryCacheSize(size_t size) { state().queryCacheSize = size; clearQueryCache(); }
+
+        /** clearQueryCache
+         *
+         * Forget all the results remembered by cachedQuery
+         */
+        inline void clearQueryCache() { if (m_state) m_state->queryCache.clear(); }
+
+        /** \brief
+         * A lazy query, results are pulled one by one and the traversal can be paused and resumed at any time
+         *
+         * The cursor holds only its position in the tree (the path back up is given by the parent links),
+         * so it allocates nothing besides the images of the range in toroidal mode, where the range wraps around the edges.
+         * Every object is reported once, in the first of its buckets that intersects the range.
+         * The range must outlive the cursor. Insertions and deferred removals keep the cursor valid,
+         * anything that deletes cells (remove, compact, removeIf, clear) invalidates it.
+         *
+         * Example usage:
+         * auto cursor = tree.cursor(range);
+         * for (int i = 0; i < budget && !cursor.done(); i++) { auto node = cursor.next(); if (node) process(node); }
+         */
+        class Cursor {
+        public:
+            /** Constructor */
+            Cursor(const QuadTree& tree, const Shape& range);
+
+            /** The range is kept by reference, a temporary would not outlive the cursor */
+            Cursor(const QuadTree& tree, const Shape&& range) = delete;
+
+            /** next
+             *
+             * Find the next object with a bound that intersects the range
+             *
+             * \return      The next found node, nullptr once the query is done
+             */
+            const Node<T, D>* next();
+
+            /** done
+             *
+             * \return      True if the whole range has been traversed
+             */
+            inline bool done() const noexcept { return m_cell == nullptr; }
+
+        private:
+            bool enter(const QuadTree* cell);
+            void advance();
+            bool owns(const Node<T, D>& node) const;
+            bool intersects(const Bound& bound) const;
+        private:
+            const QuadTree* m_root;
+            const Shape*    m_range;
+            std::vector<std::array<double, D>> m_offsets; // The images of the range, empty when the quadtree is not toroidal
+            const QuadTree* m_cell = nullptr;
+            size_t          m_index = 0;
+            bool            m_contained = false;
+        };
+
+        /** cursor
+         *
+         * Create a lazy query over the given range, see Cursor
+         *
+         * \param range     A shape that will be used to query the Quadtree, must outlive the cursor
+         * \return          A cursor positioned before the first result
+         */
+        inline Cursor cursor(const Shape& range) const { return Cursor(*this, range); }
+
+        /** The range is kept by reference, a temporary would not outlive the cursor */
+        Cursor cursor(const Shape&& range) const = delete;
+
+        /** draw
+         *
+         * Draw the quadtree using a callback function that accepts Rect and returns void
+         *
+         * Example usage:
+         * draw([](Rect& rect){ awesome_draw_rectangle_function(rect.x, rect.y, rect.width, rect.height); })
+         *
+         * \param func      A callback function to draw the quadtree with
+         */
+        inline void draw(std::function<void(const Bound&)> func) const;
+
+        /** draw
+         *
+         * Draw only the part of the quadtree that is visible, cells outside of the viewport
+         * and cells deeper than maxDepth levels below this one are not visited
+         *
+         * Example usage:
+         * draw(view, 8, [](const Rect& rect){ awesome_draw_rectangle_function(rect.x, rect.y, rect.width, rect.height); })
+         *
+         * \param viewport  The visible area, cells which do not intersect it are skipped
+         * \param maxDepth  Maximum amount of levels to descend
+         * \param func      A callback function to draw the quadtree with
+         */
+        template<typename Func>
+        inline void draw(const Bound& viewport, unsigned maxDepth, Func&& func) const;
+
+        /** heatmap
+         *
+         * Count the objects in a grid of width x height bins laid over the area (on the X and Y axes), row by row.
+         * Every live object is counted once, in the bin holding the center of its bound. A cell which falls entirely inside
+         * one bin adds the objects it holds without being descended, so coarse grids cost much less than the amount
+         * of objects. The cells straddling bins are descended, and so are the cells owning objects centered outside of them.
+         *
+         * \param area      The area covered by the grid
+         * \param width     Amount of bins along the X axis
+         * \param height    Amount of bins along the Y axis
+         * \param grid      Receives the width * height counts, the bin (x, y) is grid[y * width + x]
+         */
+        void heatmap(const Bound& area, size_t width, size_t height, std::vector<size_t>& grid) const;
+
+        /** clear
+         *
+         * Clear the quadtree and it's children recursively
+         *
+         * \return
+         */
+        inline void clear() noexcept;
+
+        /** snapshot
+         *
+         * Take an immutable snapshot of the quadtree which can be queried from other threads while the quadtree keeps changing.
+         * Snapshots share the cells that did not change since the previous snapshot, a write only invalidates the
+         * cells on the path from the modified cell to the root, so taking a snapshot rebuilds only those.
+         * The bounds of the objects are copied, moving an object afterwards does not change the snapshot.
+         * The snapshot of a quadtree backed by a monotonic resource lives in it and must not outlive its release,
+         * the snapshots of other quadtrees live on the heap so they can be dropped from any thread.
+         *
+         * \return      A snapshot of the current state of the quadtree
+         */
+        Snapshot<T, D> snapshot() const;
+
+        /** release
+         *
+         * Drop the whole structure in O(1) when the memory resource is monotonic, the cells and nodes are
+         * abandoned without being visited and their memory is reclaimed when the arena is released.
+         * The quadtree is empty afterwards. For other memory resources this is the same as clear().
+         * The observers stay subscribed, their regions are dropped with the arena and placed again by the next updateSubscriptions().
+         */
+        inline void release() noexcept;
+
+        ~QuadTree();
+    private:
+        template<typename, unsigned> friend class QuadTree; // The root keeps the regions of its observers in a quadtree
+        QuadTree() = delete;
+        bool insert(const std::shared_ptr<Node<T, D>>& node);
+        void subdivide();
+        void grow(const Bound& toward);
+        void destroy(QuadTree* cell) noexcept;
+        void discard() noexcept;
+        void touch() noexcept;
+        void touchInserted(const Node<T, D>& node) noexcept;
+        void recount() noexcept;
+        void collapse(QuadTree* target);
+        static void discardEmptyBuckets(const std::vector<QuadTree*>& buckets);
+        void query(const Shape& range, std::unordered_set<const Node<T, D>*>& foundObjects, Mask mask = AllLayers);
+        void collect(std::unordered_set<const Node<T, D>*>& foundObjects) const;
+        using Offset = std::array<double, D>;
+        static Bound shifted(const Bound& bound, const Offset& offset);
+        std::vector<Offset> images(const Shape& range) const;
+        void queryWrapped(const Shape& range, const std::vector<Offset>& offsets, std::unordered_set<const Node<T, D>*>& foundObjects, Mask mask) const;
+        double distance(const Point& point, const Bound& bound) const noexcept;
+        Bound pointBound(const Point& point) const;
+        void rasterize(const Bound& area, const size_t* bins, std::vector<size_t>& grid) const;
+        bool centers(const Bound& bound) const noexcept;
+        void scoreAll(const std::function<double(const T&)>& score) noexcept;
+        bool fitScore() noexcept;
+        bool fitMotion() noexcept;
+        void reserveSummary();
+        double maxScore() const noexcept;
+        void refit(bool moving, double time) noexcept;
+        Bound motionBound(double time) const;
+        void queryAt(const Shape& range, double time, std::unordered_set<const Node<T, D>*>& foundObjects) const;
+
+        // The live objects numbered cell by cell, for the algorithms that run over all of them
+        struct Numbering {
+            std::vector<const Node<T, D>*> nodes;
+            std::vector<std::array<double, D>> centers;
+            std::vector<const QuadTree*> cells;  // The cells holding the first bucket of at least one object
+            std::vector<size_t> firstNode;       // The objects of cells[c] are numbered from firstNode[c] up to firstNode[c + 1]
+            std::unordered_map<const Node<T, D>*, size_t> index;
+        };
+        Numbering number() const;
+        void candidates(const Numbering& numbering, size_t cell, double radius, std::vector<size_t>& found);
+        double squaredDistance(const std::array<double, D>& a, const std::array<double, D>& b) const noexcept;
+        template<typename Work>
+        static void parallel(const Numbering& numbering, unsigned threads, Work&& work);
+
+        // Octrees have no geographic mode
+        static double geoDistance(const qtree::Point& point, const Rect& bound) noexcept { return GeoCircle::minAngle(point.x, point.y, bound); }
+        template<typename P, typename B> static double geoDistance(const P&, const B&) noexcept { return 0; }
+        template<typename Predicate>
+        void markDead(const Shape& range, const std::vector<Offset>& offsets, Predicate& predicate, std::unordered_set<const Node<T, D>*>& rejected, QuadTree& root, size_t& removed);
+        std::shared_ptr<Node<T, D>> share(const Node<T, D>& node) const;
+        void record(const std::shared_ptr<Node<T, D>>& node);
+        std::vector<Bound> wrap(const Bound& region) const;
+        bool recording() const noexcept { return m_state && (m_state->trackPairs || !m_state->observers.empty()); }
+        struct RootState;
+        RootState& state();
+        void forgetChanges() noexcept;
+    private:
+        bool         m_isLeaf = true;
+        bool         m_deferRemoval = false;
+        bool         m_autoGrow = false;
+        bool         m_toroidal = false;
+        bool         m_geographic = false;
+        bool         m_hasDead = false; // Holds dead nodes, listed in the dead buckets of the root
+        int          m_level = 0; // Relative to the initial root, cells above it after growing have negative levels
+        unsigned int m_capacity;
+        unsigned int m_mergeThreshold = 0; // Opt-in hysteresis, by default only empty subtrees are merged
+        size_t       m_count = 0; // Objects in this cell and its children, objects split between cells are counted in each
+        size_t       m_owned = 0; // Live objects whose first bucket is this cell or one of its children, each is counted once
+        size_t       m_strays = 0; // The owned objects above centered outside the cell owning them, heatmap() descends to bin them
+        Mask         m_mask = 0;  // Union of the layers of the live objects in this cell and its children
+        bool         m_scored = false; // Keeps the highest score of the live objects in this cell and its children, shared by all the cells
+        bool         m_moving = false; // Keeps the expanding bound of the live objects in this cell and its children, shared by all the cells
+
+        // Aggregates of the optional features, allocated from the memory resource only while one of them is on
+        struct Summary {
+            Summary();
+
+            double maxScore = -std::numeric_limits<double>::infinity(); // Highest score of the live objects in this cell and its children
+            double time = 0;                                 // Reference time of the expanding bound, shared by all the cells
+            std::array<double, D> lower, upper;              // The expanding bound at the reference time, empty when lower > upper
+            std::array<double, D> minVelocity, maxVelocity;  // Its lower side moves by the lowest velocity, its upper side by the highest
+        };
+        Summary* m_summary = nullptr;
+        Bound        m_bounds;
+        QuadTree* m_parent = nullptr;
+        QuadTree* m_children[Children] = {};
+        MemoryResource* m_resource;
+        std::vector<std::shared_ptr<Node<T, D>>, Allocator<std::shared_ptr<Node<T, D>>>> m_nodes;
+        mutable std::shared_ptr<const typename Snapshot<T, D>::Cell> m_snapshot; // Reset whenever the cell or its subtree changes
+        size_t       m_version = 0;         // Bumped whenever the nodes or the children of this cell change
+        size_t       m_subtreeVersion = 0;  // Bumped whenever this cell or any cell below it changes
+
+        // A cached query result, valid while the versions of all the cells it touched are unchanged
+        struct CachedQuery {
+            struct Check {
+                const QuadTree* cell;
+                size_t          version;
+                bool            subtree; // The cell was contained in the range, so its whole subtree is checked
+            };
+
+            std::unordered_set<const Node<T, D>*> result;
+            std::vector<Check> checks; // In traversal order, so a deleted cell is never reached
+        };
+        struct RangeHash {
+            size_t operator()(const std::array<double, 2 * D>& key) const noexcept {
+                size_t hash = 0;
+                for (double value : key)
+                    hash = hash * 31 + std::hash<double>()(value);
+                return hash;
+            }
+        };
+        bool validate(const CachedQuery& cached) const noexcept;
+        void cachedQuery(const Bound& range, const std::vector<Offset>& offsets, CachedQuery& cached) const;
+
+        struct Observer {
+            Bound region;
+            std::vector<const Node<const size_t, D>*> entries; // The pieces of the region in the regions quadtree
+            std::unordered_set<const Node<T, D>*> visible;
+        };
+        void place(const size_t& id, Observer& observer);
+
+        // State only the root uses, allocated the first time a feature needs it so the other cells stay small
+        struct RootState {
+            // Cells holding dead nodes, compacted by the next compact()
+            std::vector<QuadTree*> deadBuckets;
+
+            // Query cache
+            size_t queryCacheSize = 64;
+            std::unordered_map<std::array<double, 2 * D>, CachedQuery, RangeHash> queryCache;
+
+            // Broadphase, the recorded nodes are kept alive until the next updatePairs()
+            bool trackPairs = false;
+            std::unordered_map<const Node<T, D>*, std::shared_ptr<Node<T, D>>> changedNodes;
+            std::unordered_map<const Node<T, D>*, std::shared_ptr<Node<T, D>>> endedNodes;
+            std::unordered_map<const Node<T, D>*, std::unordered_set<const Node<T, D>*>> pairs;
+
+            // Area of interest, the regions of the observers are indexed by their own quadtree
+            size_t nextObserver = 0;
+            std::unordered_map<size_t, Observer> observers;
+            std::unique_ptr<QuadTree<const size_t, D>> regions;
+            std::unordered_set<size_t> movedObservers;
+            std::unordered_map<const Node<T, D>*, std::shared_ptr<Node<T, D>>> watchedNodes;
+            std::unordered_map<const Node<T, D>*, std::shared_ptr<Node<T, D>>> leftNodes;
+            std::unordered_map<const Node<T, D>*, std::vector<size_t>> observedBy;
+
+            // Score function, the cells only keep the highest score of their subtree
+            std::function<double(const T&)> score;
+        };
+        std::unique_ptr<RootState> m_state;
+    };
+
+    /** The 3D analog of the quadtree, every cell has eight children */
+    template<typename T>
+    using Octree = QuadTree<T, 3>;
+
+    /** \brief
+     * Immutable view of a quadtree at the time QuadTree::snapshot() was called
+     *
+     * Its cells are shared with other snapshots of the same quadtree and are never modified,
+     * so a snapshot can be copied and queried from any thread.
+     *
+     */
+    template<typename T, unsigned D>
+    class Snapshot {
+    public:
+        using Shape = typename Space<D>::Shape;
+        using Bound = typename Space<D>::Bound;
+
+        /** An object as it was when the snapshot was taken */
+        struct Object {
+            const Node<T, D>* node; // Tells the objects apart, it is not kept alive by the snapshot
+            T* data;
+            Bound bound;
+        };
+
+        /** Constructor, an empty snapshot */
+        Snapshot() = default;
+
+        /** query
+         *
+         * Query the snapshot with a given range, see QuadTree::query
+         *
+         * \param range     A shape that will be used to query the snapshot
+         * \return          The unique objects which their bound intersected the given range
+         */
+        std::vector<Object> query(const Shape& range) const;
+
+    private:
+        friend class QuadTree<T, D>;
+
+        struct Cell {
+            Cell(const Bound& bounds, MemoryResource* resource) : bounds(bounds), objects(Allocator<Object>(resource)) {}
+
+            Bound bounds;
+            bool isLeaf = true;
+            std::vector<Object, Allocator<Object>> objects;
+            std::shared_ptr<const Cell> children[QuadTree<T, D>::Children];
+        };
+
+        explicit Snapshot(std::shared_ptr<const Cell> root) : m_root(std::move(root)) {}
+
+        static void query(const Cell& cell, const Shape& range, std::unordered_set<const Node<T, D>*>& found, std::vector<Object>& objects);
+    private:
+        std::shared_ptr<const Cell> m_root;
+    };
+
+    /** Quadtree implementation  */
+    template<typename T, unsigned D>
+    constexpr unsigned QuadTree<T, D>::Children;
+
+    template<typename T, unsigned D>
+    inline QuadTree<T, D>::QuadTree(const Bound& _bound, unsigned _capacity, MemoryResource* _resource) :
+        m_capacity(_capacity),
+        m_bounds(_bound),
+        m_resource(_resource),
+        m_nodes(Allocator<std::shared_ptr<Node<T, D>>>(_resource))
+    {
+        m_nodes.reserve(_capacity);
+    }
+
+    template<typename T, unsigned D>
+    inline QuadTree<T, D>::Summary::Summary()
+    {
+        lower.fill(std::numeric_limits<double>::infinity());
+        upper.fill(-std::numeric_limits<double>::infinity());
+        minVelocity.fill(std::numeric_limits<double>::infinity());
+        maxVelocity.fill(-std::numeric_limits<double>::infinity());
+    }
+
+    template<typename T, unsigned D>
+    inline double QuadTree<T, D>::maxScore() const noexcept
+    {
+        // Without a score function every object scores 0
+        if (m_scored) return m_summary->maxScore;
+        return m_count ? 0 : -std::numeric_limits<double>::infinity();
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::reserveSummary()
+    {
+        // Cells without any optional feature on keep to the counts and the layers.
+        // The summary of the root outlives release(), so it does not come from the arena
+        MemoryResource* resource = m_parent ? m_resource : defaultResource();
+        bool needed = m_scored || m_moving;
+        if (needed && !m_summary)
+        {
+            m_summary = new (resource->allocate(sizeof(Summary), alignof(Summary))) Summary();
+        }
+        else if (!needed && m_summary)
+        {
+            resource->deallocate(m_summary, sizeof(Summary), alignof(Summary));
+            m_summary = nullptr;
+        }
+    }
+
+    template<typename T, unsigned D>
+    inline bool QuadTree<T, D>::insert(const std::shared_ptr<Node<T, D>>& node)
+    {
+        // Only the root grows, the children never have auto grow turned on
+        while (m_autoGrow && !m_bounds.intersects(node->bound)) grow(node->bound);
+
+        // Only the root scores, before the node reaches its leaves
+        if (m_state && m_state->score) node->score = m_state->score(*node->data);
+
+        if (!m_bounds.intersects(node->bound)) return false;
+
+        // Subdivide if required
+        if (m_isLeaf && m_nodes.size() >= m_capacity) {
+            subdivide();
+        }
+
+        // insert object into it's leaves
+        if (!m_isLeaf) {
+            for (QuadTree* child : m_children)
+                child->insert(node);
+        }
+        else
+        {
+            LOG_DEBUG("Insert node: " << &*node.get() << " Holding Point: " << node->data);
+            m_nodes.push_back(node);
+            node->qt.emplace_back(this);
+            touchInserted(*node);
+        }
+
+        // Only the root tracks the pairs
+        if (recording()) record(node);
+
+        return true;
+    }
+
+    template<typename T, unsigned D>
+    inline bool QuadTree<T, D>::remove(const Node<T, D>& node)
+    {
+        if (node.dead) return false;
+
+        if (recording()) record(share(node));
+
+        if (m_deferRemoval)
+        {
+            const_cast<Node<T, D>&>(node).dead = true;
+            for (auto t : node.qt)
+            {
+                t->touch();
+                if (!t->m_hasDead)
+                {
+                    t->m_hasDead = true;
+                    state().deadBuckets.push_back(t);
+                }
+            }
+            return true;
+        }
+
+        // Removing the node from its last bucket releases it, so iterate over a copy of the backlinks
+        const_cast<Node<T, D>&>(node).dead = true;
+        std::vector<QuadTree*> buckets(node.qt.begin(), node.qt.end());
+        for (auto t : buckets)
+        {
+            auto& nodes = t->m_nodes;
+            nodes.erase(std::find_if(nodes.begin(), nodes.end(), [&](const auto& other) { return other.get() == &node; }));
+            t->touch();
+        }
+
+        // Merge only once the node left all of its buckets, merging may delete some of them
+        discardEmptyBuckets(buckets);
+
+        return true;
+    }
+
+    template<typename T, unsigned D>
+    inline bool QuadTree<T, D>::move(const Node<T, D>& node, const Bound& bound)
+    {
+        if (node.dead) return false;
+
+        Node<T, D>& target = const_cast<Node<T, D>&>(node);
+        QuadTree* leaf = node.qt.front();
+        if (m_state && m_state->score) target.score = m_state->score(*target.data);
+
+        // Strictly inside its only leaf the node would not reach any other cell
+        bool inside = node.qt.size() == 1 && leaf->m_isLeaf;
+        for (unsigned axis = 0; axis < D && inside; ++axis)
+        {
+            double lower = Space<D>::lower(leaf->m_bounds, axis);
+            double upper = lower + Space<D>::extent(leaf->m_bounds, axis);
+            inside = Space<D>::lower(bound, axis) > lower && Space<D>::lower(bound, axis) + Space<D>::extent(bound, axis) < upper;
+        }
+
+        if (inside)
+        {
+            target.bound = bound;
+            leaf->touch();
+            if (recording()) record(share(node));
+            return true;
+        }
+
+        // Relink the node to the leaves of its new bound, the emptied cells are merged only once it is back in
+        std::shared_ptr<Node<T, D>> shared = share(node);
+        std::vector<QuadTree*> buckets(node.qt.begin(), node.qt.end());
+        for (auto t : buckets)
+        {
+            auto& nodes = t->m_nodes;
+            nodes.erase(std::find(nodes.begin(), nodes.end(), shared));
+            t->touch();
+        }
+        target.qt.clear();
+        target.bound = bound;
+
+        bool inserted = insert(shared);
+        if (!inserted)
+        {
+            target.dead = true;
+            if (recording()) record(shared);
+        }
+
+        // Cells listed for the next compact() may not be merged away before it
+        if (m_deferRemoval)
+        {
+            for (auto t : buckets)
+            {
+                if (!t->m_hasDead)
+                {
+                    t->m_hasDead = true;
+                    state().deadBuckets.push_back(t);
+                }
+
+                for (QuadTree* cell = t; cell; cell = cell->m_parent)
+                    cell->recount();
+            }
+            return inserted;
+        }
+
+        discardEmptyBuckets(buckets);
+
+        return inserted;
+    }
+
+    template<typename T, unsigned D>
+    inline bool QuadTree<T, D>::move(const Node<T, D>& node, const Bound& bound, const Velocity& velocity, double time)
+    {
+        if (node.dead) return false;
+
+        // The expanding bounds are gathered from the new trajectory when the node is relinked
+        Node<T, D>& target = const_cast<Node<T, D>&>(node);
+        target.velocity = velocity;
+        target.time = time;
+        return move(node, bound);
+    }
+
+    template<typename T, unsigned D>
+    inline typename QuadTree<T, D>::RootState& QuadTree<T, D>::state()
+    {
+        if (!m_state) m_state.reset(new RootState());
+        return *m_state;
+    }
+
+    template<typename T, unsigned D>
+    inline std::shared_ptr<Node<T, D>> QuadTree<T, D>::share(const Node<T, D>& node) const
+    {
+        const auto& nodes = node.qt.front()->m_nodes;
+        return *std::find_if(nodes.begin(), nodes.end(), [&](const auto& other) { return other.get() == &node; });
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::record(const std::shared_ptr<Node<T, D>>& node)
+    {
+        if (m_state && m_state->trackPairs) m_state->changedNodes[node.get()] = node;
+        if (m_state && !m_state->observers.empty()) m_state->watchedNodes[node.get()] = node;
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::forgetChanges() noexcept
+    {
+        if (!m_state) return;
+
+        m_state->changedNodes.clear();
+        m_state->endedNodes.clear();
+        m_state->pairs.clear();
+
+        // The observers stay subscribed, they see again what is inserted from now on
+        m_state->watchedNodes.clear();
+        m_state->leftNodes.clear();
+        m_state->observedBy.clear();
+        for (auto& observer : m_state->observers)
+            observer.second.visible.clear();
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::setPairTracking(bool tracking)
+    {
+        state().trackPairs = tracking;
+        forgetChanges();
+        if (!tracking) return;
+
+        // Every object is recorded, so the next update reports all the current pairs
+        std::unordered_set<const Node<T, D>*> nodes;
+        collect(nodes);
+        for (const Node<T, D>* node : nodes)
+            if (!node->dead) m_state->changedNodes[node] = share(*node);
+    }
+
+    template<typename T, unsigned D>
+    inline typename QuadTree<T, D>::PairEvents QuadTree<T, D>::updatePairs()
+    {
+        PairEvents events;
+        if (!m_state) return events;
+
+        auto& changedNodes = m_state->changedNodes;
+        auto& allPairs = m_state->pairs;
+        auto makePair = [](const Node<T, D>* a, const Node<T, D>* b) { return a < b ? Pair{ a, b } : Pair{ b, a }; };
+
+        for (const auto& changed : changedNodes)
+        {
+            const Node<T, D>* node = changed.first;
+            std::unordered_set<const Node<T, D>*> overlapping;
+            if (!node->dead)
+            {
+                overlapping = query(node->bound);
+                overlapping.erase(node);
+            }
+
+            // Both sides of a pair are updated together, so a pair of two changed objects is reported once
+            auto& pairs = allPairs[node];
+            for (const Node<T, D>* other : overlapping)
+            {
+                if (pairs.insert(other).second)
+                {
+                    allPairs[other].insert(node);
+                    events.begin.push_back(makePair(node, other));
+                }
+            }
+
+            for (auto it = pairs.begin(); it != pairs.end();)
+            {
+                if (overlapping.count(*it)) { ++it; continue; }
+
+                auto& otherPairs = allPairs[*it];
+                otherPairs.erase(node);
+                if (otherPairs.empty()) allPairs.erase(*it);
+                events.end.push_back(makePair(node, *it));
+                it = pairs.erase(it);
+            }
+
+            if (pairs.empty()) allPairs.erase(node);
+        }
+
+        // The ended pairs of the removed nodes are handed out before the nodes are released
+        m_state->endedNodes.swap(changedNodes);
+        changedNodes.clear();
+
+        return events;
+    }
+
+    template<typename T, unsigned D>
+    inline size_t QuadTree<T, D>::subscribe(const Bound& region)
+    {
+        RootState& root = state();
+        if (!root.regions)
+        {
+            root.regions.reset(new QuadTree<const size_t, D>(m_bounds, m_capacity, m_resource));
+            root.regions->setAutoGrow(!m_toroidal);
+        }
+
+        size_t id = root.nextObserver++;
+        root.observers.emplace(id, Observer{ region, {}, {} });
+        setRegion(id, region);
+        return id;
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::setRegion(size_t observer, const Bound& region)
+    {
+        auto it = m_state->observers.find(observer);
+        Observer& o = it->second;
+        o.region = region;
+
+        if (o.entries.size() == 1 && wrap(region).size() == 1)
+        {
+            if (!m_state->regions->move(*o.entries.front(), region)) o.entries.clear();
+        }
+        else
+        {
+            for (const Node<const size_t, D>* entry : o.entries)
+                m_state->regions->remove(*entry);
+            o.entries.clear();
+        }
+
+        if (o.entries.empty()) place(it->first, o);
+        m_state->movedObservers.insert(observer);
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::place(const size_t& id, Observer& observer)
+    {
+        // Around a torus a region crossing the edges is split into pieces inside the bounds,
+        // the id stored in the map is the object of the pieces
+        QuadTree<const size_t, D>& regions = *m_state->regions;
+        for (const Bound& piece : wrap(observer.region))
+        {
+            auto entry = std::allocate_shared<Node<const size_t, D>>(Allocator<Node<const size_t, D>>(m_resource), &id, piece, m_resource);
+            if (regions.insert(entry)) observer.entries.push_back(entry.get());
+        }
+    }
+
+    template<typename T, unsigned D>
+    inline std::vector<typename QuadTree<T, D>::Bound> QuadTree<T, D>::wrap(const Bound& region) const
+    {
+        if (!m_toroidal) return { region };
+
+        // The intervals covered on every axis, the part past an edge comes back from the opposite edge
+        std::array<std::vector<std::pair<double, double>>, D> intervals;
+        for (unsigned axis = 0; axis < D; ++axis)
+        {
+            double period = Space<D>::extent(m_bounds, axis);
+            double begin = Space<D>::lower(m_bounds, axis), end = begin + period;
+            double lower = std::fmod(Space<D>::lower(region, axis) - begin, period);
+            if (lower < 0) lower += period;
+            lower += begin;
+            double upper = lower + Space<D>::extent(region, axis);
+
+            if (upper - lower >= period) intervals[axis].emplace_back(begin, end);
+            else
+            {
+                intervals[axis].emplace_back(lower, std::min(upper, end));
+                if (upper > end) intervals[axis].emplace_back(begin, upper - period);
+            }
+        }
+
+        std::vector<Bound> pieces(1, m_bounds);
+        for (unsigned axis = 0; axis < D; ++axis)
+        {
+            std::vector<Bound> split;
+            for (const Bound& piece : pieces)
+            {
+                for (const auto& interval : intervals[axis])
+                {
+                    double lower[D], extent[D];
+                    for (unsigned other = 0; other < D; ++other)
+                    {
+                        lower[other] = Space<D>::lower(piece, other);
+                        extent[other] = Space<D>::extent(piece, other);
+                    }
+                    lower[axis] = interval.first;
+                    extent[axis] = interval.second - interval.first;
+                    split.push_back(Space<D>::bound(lower, extent));
+                }
+            }
+            pieces.swap(split);
+        }
+        return pieces;
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::unsubscribe(size_t observer)
+    {
+        if (!m_state) return;
+
+        RootState& root = *m_state;
+        auto it = root.observers.find(observer);
+        if (it == root.observers.end()) return;
+
+        for (const Node<T, D>* node : it->second.visible)
+        {
+            auto& observers = root.observedBy[node];
+            observers.erase(std::find(observers.begin(), observers.end(), observer));
+            if (observers.empty()) root.observedBy.erase(node);
+        }
+
+        for (const Node<const size_t, D>* entry : it->second.entries)
+            root.regions->remove(*entry);
+        root.movedObservers.erase(observer);
+        root.observers.erase(it);
+
+        if (root.observers.empty()) root.watchedNodes.clear();
+    }
+
+    template<typename T, unsigned D>
+    inline typename QuadTree<T, D>::VisibilityEvents QuadTree<T, D>::updateSubscriptions()
+    {
+        VisibilityEvents events;
+        if (!m_state) return events;
+
+        RootState& root = *m_state;
+        auto enter = [&](size_t observer, const Node<T, D>* node) {
+            root.observers.at(observer).visible.insert(node);
+            root.observedBy[node].push_back(observer);
+            events.enter.push_back({ observer, node });
+        };
+        auto leave = [&](size_t observer, const Node<T, D>* node) {
+            root.observers.at(observer).visible.erase(node);
+            auto& observers = root.observedBy[node];
+            observers.erase(std::find(observers.begin(), observers.end(), observer));
+            if (observers.empty()) root.observedBy.erase(node);
+            events.leave.push_back({ observer, node });
+        };
+
+        // The regions dropped by release() are placed again, once the memory they used may have been reclaimed
+        for (size_t observer : root.movedObservers)
+        {
+            auto it = root.observers.find(observer);
+            if (it->second.entries.empty()) place(it->first, it->second);
+        }
+
+        // A changed object finds the observers that see it now with one query of the regions
+        for (const auto& changed : root.watchedNodes)
+        {
+            const Node<T, D>* node = changed.first;
+            std::vector<size_t> now;
+            if (!node->dead)
+            {
+                for (const Node<const size_t, D>* entry : root.regions->query(node->bound))
+                    if (std::find(now.begin(), now.end(), *entry->data) == now.end()) now.push_back(*entry->data);
+            }
+
+            auto found = root.observedBy.find(node);
+            std::vector<size_t> before = found != root.observedBy.end() ? found->second : std::vector<size_t>();
+            for (size_t observer : now)
+                if (std::find(before.begin(), before.end(), observer) == before.end()) enter(observer, node);
+            for (size_t observer : before)
+                if (std::find(now.begin(), now.end(), observer) == now.end()) leave(observer, node);
+        }
+
+        // A moved observer queries its new region
+        for (size_t observer : root.movedObservers)
+        {
+            Observer& o = root.observers.at(observer);
+            std::unordered_set<const Node<T, D>*> now = query(o.region);
+
+            std::vector<const Node<T, D>*> left;
+            for (const Node<T, D>* node : o.visible)
+                if (!now.count(node)) left.push_back(node);
+            for (const Node<T, D>* node : left)
+                leave(observer, node);
+            for (const Node<T, D>* node : now)
+                if (!o.visible.count(node)) enter(observer, node);
+        }
+        root.movedObservers.clear();
+
+        // The nodes which left are handed out before the removed ones are released
+        root.leftNodes.swap(root.watchedNodes);
+        root.watchedNodes.clear();
+
+        return events;
+    }
+
+    template<typename T, unsigned D>
+    template<typename Func>
+    inline void QuadTree<T, D>::forEachPair(Func&& func) const
+    {
+        if (!m_state) return;
+
+        for (const auto& pairs : m_state->pairs)
+        {
+            for (const Node<T, D>* other : pairs.second)
+                if (pairs.first < other) func(*pairs.first, *other);
+        }
+    }
+
+    template<typename T, unsigned D>
+    template<typename Predicate>
+    inline size_t QuadTree<T, D>::removeIf(const Shape& range, Predicate&& predicate)
+    {
+        // A toroidal range also reaches the objects through the opposite edges
+        size_t removed = 0;
+        std::vector<Offset> offsets = m_toroidal ? images(range) : std::vector<Offset>(1, Offset{});
+        std::unordered_set<const Node<T, D>*> rejected;
+        markDead(range, offsets, predicate, rejected, *this, removed);
+
+        if (!m_deferRemoval) compact();
+
+        return removed;
+    }
+
+    template<typename T, unsigned D>
+    template<typename Predicate>
+    inline void QuadTree<T, D>::markDead(const Shape& range, const std::vector<Offset>& offsets, Predicate& predicate, std::unordered_set<const Node<T, D>*>& rejected, QuadTree& root, size_t& removed)
+    {
+        bool intersects = false, contained = false;
+        for (const Offset& offset : offsets)
+        {
+            Bound image = shifted(m_bounds, offset);
+            intersects = intersects || range.intersects(image);
+            contained = contained || range.contains(image);
+        }
+        if (!intersects) return;
+
+        for (const auto& node : m_nodes)
+        {
+            if (node->dead) continue;
+
+            bool found = contained;
+            for (size_t i = 0; i < offsets.size() && !found; ++i)
+                found = range.intersects(shifted(node->bound, offsets[i]));
+
+            if (!found) continue;
+
+            // The predicate runs once per object, a rejected object split between cells is remembered for its other buckets
+            bool split = node->qt.size() > 1;
+            if (split && rejected.count(node.get())) continue;
+            if (!predicate(static_cast<const Node<T, D>&>(*node)))
+            {
+                if (split) rejected.insert(node.get());
+                continue;
+            }
+
+            // The node may also sit in buckets outside of the range, all of them are compacted later
+            if (root.recording()) root.record(node);
+            node->dead = true;
+            removed++;
+            for (auto t : node->qt)
+            {
+                t->touch();
+                if (!t->m_hasDead)
+                {
+                    t->m_hasDead = true;
+                    root.state().deadBuckets.push_back(t);
+                }
+            }
+        }
+
+        if (!m_isLeaf)
+        {
+            for (QuadTree* child : m_children)
+            {
+                child->markDead(range, offsets, predicate, rejected, root, removed);
+            }
+        }
+    }
+
+    template<typename T, unsigned D>
+    inline std::unordered_set<const Node<T, D>*> QuadTree<T, D>::query(const Shape& range)
+    {
+        return query(range, AllLayers);
+    }
+
+    template<typename T, unsigned D>
+    inline std::unordered_set<const Node<T, D>*> QuadTree<T, D>::query(const Shape& range, Mask mask)
+    {
+        std::unordered_set<const Node<T, D>*> foundObjects;
+        if (!m_toroidal)
+        {
+            query(range, foundObjects, mask);
+            return foundObjects;
+        }
+
+        std::vector<Offset> offsets = images(range);
+        if (!offsets.empty()) queryWrapped(range, offsets, foundObjects, mask);
+        return foundObjects;
+    }
+
+    template<typename T, unsigned D>
+    inline std::vector<typename QuadTree<T, D>::Offset> QuadTree<T, D>::images(const Shape& range) const
+    {
+        // The images of the space the range reaches, shifted by a period on some of the axes
+        std::vector<Offset> offsets;
+        unsigned images = 1;
+        for (unsigned axis = 0; axis < D; ++axis) images *= 3;
+        for (unsigned image = 0; image < images; ++image)
+        {
+            Offset offset;
+            for (unsigned axis = 0, i = image; axis < D; ++axis, i /= 3)
+                offset[axis] = (double(i % 3) - 1) * Space<D>::extent(m_bounds, axis);
+
+            if (range.intersects(shifted(m_bounds, offset)))
+                offsets.push_back(offset);
+        }
+        return offsets;
+    }
+
+    template<typename T, unsigned D>
+    inline typename QuadTree<T, D>::Bound QuadTree<T, D>::shifted(const Bound& bound, const Offset& offset)
+    {
+        double lower[D], extent[D];
+        for (unsigned axis = 0; axis < D; ++axis)
+        {
+            lower[axis] = Space<D>::lower(bound, axis) + offset[axis];
+            extent[axis] = Space<D>::extent(bound, axis);
+        }
+        return Space<D>::bound(lower, extent);
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::queryWrapped(const Shape& range, const std::vector<Offset>& offsets, std::unordered_set<const Node<T, D>*>& foundObjects, Mask mask) const
+    {
+        if (!(m_mask & mask)) return;
+
+        bool intersects = false, contained = false;
+        for (const Offset& offset : offsets)
+        {
+            Bound image = shifted(m_bounds, offset);
+            intersects = intersects || range.intersects(image);
+            contained = contained || range.contains(image);
+        }
+        if (!intersects) return;
+
+        for (const auto& node : m_nodes)
+        {
+            if (node->dead || !(node->mask & mask)) continue;
+
+            bool found = contained;
+            for (size_t i = 0; i < offsets.size() && !found; ++i)
+                found = range.intersects(shifted(node->bound, offsets[i]));
+
+            if (found) foundObjects.insert(node.get());
+        }
+
+        if (!m_isLeaf)
+        {
+            for (const QuadTree* child : m_children)
+                child->queryWrapped(range, offsets, foundObjects, mask);
+        }
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::setMoving(bool moving, double time)
+    {
+        refit(moving, time);
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::tighten(double time)
+    {
+        std::unordered_set<const Node<T, D>*> nodes;
+        collect(nodes);
+
+        // Relinking grows and merges cells, so the objects are gathered first
+        for (const Node<T, D>* node : nodes)
+            move(*node, predict(*node, time), node->velocity, time);
+
+        refit(m_moving, time);
+    }
+
+    template<typename T, unsigned D>
+    inline typename QuadTree<T, D>::Bound QuadTree<T, D>::predict(const Node<T, D>& node, double time)
+    {
+        double lower[D], extent[D];
+        for (unsigned axis = 0; axis < D; ++axis)
+        {
+            lower[axis] = Space<D>::lower(node.bound, axis) + node.velocity[axis] * (time - node.time);
+            extent[axis] = Space<D>::extent(node.bound, axis);
+        }
+        return Space<D>::bound(lower, extent);
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::refit(bool moving, double time) noexcept
+    {
+        // The children are fitted first, every cell gathers the bounds of its children
+        m_moving = moving;
+        reserveSummary();
+        if (m_summary) m_summary->time = time;
+        if (!m_isLeaf)
+        {
+            for (QuadTree* child : m_children)
+                child->refit(moving, time);
+        }
+        if (moving) fitMotion();
+    }
+
+    template<typename T, unsigned D>
+    inline bool QuadTree<T, D>::fitMotion() noexcept
+    {
+        std::array<double, D> lower, upper, minVelocity, maxVelocity;
+        lower.fill(std::numeric_limits<double>::infinity());
+        upper.fill(-std::numeric_limits<double>::infinity());
+        minVelocity.fill(std::numeric_limits<double>::infinity());
+        maxVelocity.fill(-std::numeric_limits<double>::infinity());
+
+        // Every object is brought to the reference time along its velocity
+        for (const auto& node : m_nodes)
+        {
+            if (node->dead) continue;
+
+            for (unsigned axis = 0; axis < D; ++axis)
+            {
+                double velocity = node->velocity[axis];
+                double position = Space<D>::lower(node->bound, axis) + velocity * (m_summary->time - node->time);
+                lower[axis] = std::min(lower[axis], position);
+                upper[axis] = std::max(upper[axis], position + Space<D>::extent(node->bound, axis));
+                minVelocity[axis] = std::min(minVelocity[axis], velocity);
+                maxVelocity[axis] = std::max(maxVelocity[axis], velocity);
+            }
+        }
+
+        if (!m_isLeaf)
+        {
+            for (const QuadTree* child : m_children)
+            {
+                for (unsigned axis = 0; axis < D; ++axis)
+                {
+                    const Summary& summary = *child->m_summary;
+                    lower[axis] = std::min(lower[axis], summary.lower[axis]);
+                    upper[axis] = std::max(upper[axis], summary.upper[axis]);
+                    minVelocity[axis] = std::min(minVelocity[axis], summary.minVelocity[axis]);
+                    maxVelocity[axis] = std::max(maxVelocity[axis], summary.maxVelocity[axis]);
+                }
+            }
+        }
+
+        Summary& summary = *m_summary;
+        bool changed = lower != summary.lower || upper != summary.upper || minVelocity != summary.minVelocity || maxVelocity != summary.maxVelocity;
+        summary.lower = lower;
+        summary.upper = upper;
+        summary.minVelocity = minVelocity;
+        summary.maxVelocity = maxVelocity;
+        return changed;
+    }
+
+    template<typename T, unsigned D>
+    inline typename QuadTree<T, D>::Bound QuadTree<T, D>::motionBound(double time) const
+    {
+        // Before the reference time the sides move backwards, the lower side by the highest velocity
+        const Summary& summary = *m_summary;
+        double dt = time - summary.time;
+        double lower[D], extent[D];
+        for (unsigned axis = 0; axis < D; ++axis)
+        {
+            lower[axis] = summary.lower[axis] + (dt >= 0 ? summary.minVelocity[axis] : summary.maxVelocity[axis]) * dt;
+            double upper = summary.upper[axis] + (dt >= 0 ? summary.maxVelocity[axis] : summary.minVelocity[axis]) * dt;
+            extent[axis] = upper - lower[axis];
+        }
+        return Space<D>::bound(lower, extent);
+    }
+
+    template<typename T, unsigned D>
+    inline std::unordered_set<const Node<T, D>*> QuadTree<T, D>::queryAt(const Shape& range, double time) const
+    {
+        std::unordered_set<const Node<T, D>*> foundObjects;
+        queryAt(range, time, foundObjects);
+        return foundObjects;
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::queryAt(const Shape& range, double time, std::unordered_set<const Node<T, D>*>& foundObjects) const
+    {
+        // Without the expanding bounds every cell has to be visited
+        if (m_moving)
+        {
+            // An empty subtree has no expanding bound
+            if (m_summary->lower[0] > m_summary->upper[0]) return;
+
+            Bound reach = motionBound(time);
+            if (!range.intersects(reach)) return;
+            if (range.contains(reach))
+            {
+                collect(foundObjects);
+                return;
+            }
+        }
+
+        for (const auto& node : m_nodes)
+        {
+            if (!node->dead && range.intersects(predict(*node, time)))
+                foundObjects.insert(node.get());
+        }
+
+        if (!m_isLeaf)
+        {
+            for (const QuadTree* child : m_children)
+                child->queryAt(range, time, foundObjects);
+        }
+    }
+
+    template<typename T, unsigned D>
+    inline double QuadTree<T, D>::distance(const Point& point, const Bound& bound) const noexcept
+    {
+        if (m_geographic) return geoDistance(point, bound);
+
+        double squared = 0;
+        for (unsigned axis = 0; axis < D; ++axis)
+        {
+            double c = Space<D>::coord(point, axis);
+            double lower = Space<D>::lower(bound, axis);
+            double upper = lower + Space<D>::extent(bound, axis);
+            double d = std::max({ lower - c, 0.0, c - upper });
+
+            // Around a torus the bound may be closer through the opposite edge
+            if (m_toroidal)
+            {
+                double period = Space<D>::extent(m_bounds, axis);
+                d = std::min({ d,
+                    std::max({ lower - (c + period), 0.0, (c + period) - upper }),
+                    std::max({ lower - (c - period), 0.0, (c - period) - upper }) });
+            }
+            squared += d * d;
+        }
+        return std::sqrt(squared);
+    }
+
+    template<typename T, unsigned D>
+    inline typename QuadTree<T, D>::Bound QuadTree<T, D>::pointBound(const Point& point) const
+    {
+        if (!m_geographic) return Space<D>::bound(point);
+
+        // A unit sized bound would span a whole degree
+        double lower[D], extent[D];
+        for (unsigned axis = 0; axis < D; ++axis)
+        {
+            lower[axis] = Space<D>::coord(point, axis);
+            extent[axis] = 0;
+        }
+        return Space<D>::bound(lower, extent);
+    }
+
+    template<typename T, unsigned D>
+    inline std::vector<const Node<T, D>*> QuadTree<T, D>::nearest(const Point& point, size_t k, double epsilon, size_t budget) const
+    {
+        using Candidate = std::pair<double, const Node<T, D>*>;
+        using Cell = std::pair<double, const QuadTree*>;
+
+        std::vector<Candidate> best; // Max heap of the k closest found so far
+        std::priority_queue<Cell, std::vector<Cell>, std::greater<Cell>> cells;
+        if (k == 0) return {};
+        cells.emplace(distance(point, m_bounds), this);
+
+        for (size_t visited = 0; !cells.empty() && visited < budget; ++visited)
+        {
+            Cell cell = cells.top();
+            cells.pop();
+            if (best.size() == k && cell.first * (1 + epsilon) > best.front().first) break;
+
+            for (const auto& node : cell.second->m_nodes)
+            {
+                if (node->dead) continue;
+
+                double d = distance(point, node->bound);
+                if (best.size() == k && d >= best.front().first) continue;
+
+                // A node split between cells is met more than once
+                if (std::find_if(best.begin(), best.end(), [&](const Candidate& c) { return c.second == node.get(); }) != best.end()) continue;
+
+                best.emplace_back(d, node.get());
+                std::push_heap(best.begin(), best.end());
+                if (best.size() > k)
+                {
+                    std::pop_heap(best.begin(), best.end());
+                    best.pop_back();
+                }
+            }
+
+            if (!cell.second->m_isLeaf)
+            {
+                for (const QuadTree* child : cell.second->m_children)
+                {
+                    double d = distance(point, child->m_bounds);
+                    if (best.size() < k || d * (1 + epsilon) <= best.front().first)
+                        cells.emplace(d, child);
+                }
+            }
+        }
+
+        std::sort_heap(best.begin(), best.end());
+        std::vector<const Node<T, D>*> result;
+        result.reserve(best.size());
+        for (const Candidate& candidate : best)
+            result.push_back(candidate.second);
+        return result;
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::setScore(std::function<double(const T&)> score)
+    {
+        RootState& root = state();
+        root.score = std::move(score);
+        scoreAll(root.score);
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::scoreAll(const std::function<double(const T&)>& score) noexcept
+    {
+        // The children are scored first, a node split between cells is scored in each of its buckets
+        m_scored = static_cast<bool>(score);
+        reserveSummary();
+        double maxScore = -std::numeric_limits<double>::infinity();
+        if (!m_isLeaf)
+        {
+            for (QuadTree* child : m_children)
+            {
+                child->scoreAll(score);
+                maxScore = std::max(maxScore, child->maxScore());
+            }
+        }
+
+        for (const auto& node : m_nodes)
+        {
+            node->score = score ? score(*node->data) : 0;
+            if (!node->dead) maxScore = std::max(maxScore, node->score);
+        }
+        if (m_scored) m_summary->maxScore = maxScore;
+    }
+
+    template<typename T, unsigned D>
+    inline bool QuadTree<T, D>::fitScore() noexcept
+    {
+        double maxScore = -std::numeric_limits<double>::infinity();
+        for (const auto& node : m_nodes)
+        {
+            if (!node->dead) maxScore = std::max(maxScore, node->score);
+        }
+
+        if (!m_isLeaf)
+        {
+            for (const QuadTree* child : m_children)
+                maxScore = std::max(maxScore, child->m_summary->maxScore);
+        }
+
+        bool changed = maxScore != m_summary->maxScore;
+        m_summary->maxScore = maxScore;
+        return changed;
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::rescore(const Node<T, D>& node)
+    {
+        if (node.dead) return;
+
+        const_cast<Node<T, D>&>(node).score = m_state && m_state->score ? m_state->score(*node.data) : 0;
+        for (auto t : node.qt)
+            t->touch();
+    }
+
+    template<typename T, unsigned D>
+    inline std::vector<const Node<T, D>*> QuadTree<T, D>::topK(const Shape& range, size_t k) const
+    {
+        using Candidate = std::pair<double, const Node<T, D>*>;
+        using Cell = std::pair<double, const QuadTree*>;
+
+        std::vector<Candidate> best; // Min heap of the k highest scores found so far
+        std::priority_queue<Cell> cells;
+        if (k == 0) return {};
+
+        // A toroidal range also reaches the objects through the opposite edges
+        std::vector<Offset> offsets = m_toroidal ? images(range) : std::vector<Offset>(1, Offset{});
+        auto intersects = [&](const Bound& bound) {
+            for (const Offset& offset : offsets)
+                if (range.intersects(shifted(bound, offset))) return true;
+            return false;
+        };
+        auto contains = [&](const Bound& bound) {
+            for (const Offset& offset : offsets)
+                if (range.contains(shifted(bound, offset))) return true;
+            return false;
+        };
+
+        if (intersects(m_bounds)) cells.emplace(maxScore(), this);
+
+        while (!cells.empty())
+        {
+            Cell cell = cells.top();
+            cells.pop();
+            if (best.size() == k && cell.first <= best.front().first) break;
+
+            bool contained = contains(cell.second->m_bounds);
+            for (const auto& node : cell.second->m_nodes)
+            {
+                if (node->dead) continue;
+                if (best.size() == k && node->score <= best.front().first) continue;
+                if (!contained && !intersects(node->bound)) continue;
+
+                // A node split between cells is met more than once
+                if (std::find_if(best.begin(), best.end(), [&](const Candidate& c) { return c.second == node.get(); }) != best.end()) continue;
+
+                best.emplace_back(node->score, node.get());
+                std::push_heap(best.begin(), best.end(), std::greater<Candidate>());
+                if (best.size() > k)
+                {
+                    std::pop_heap(best.begin(), best.end(), std::greater<Candidate>());
+                    best.pop_back();
+                }
+            }
+
+            if (!cell.second->m_isLeaf)
+            {
+                for (const QuadTree* child : cell.second->m_children)
+                {
+                    // An empty subtree has no score at all
+                    double score = child->maxScore();
+                    if (score == -std::numeric_limits<double>::infinity()) continue;
+                    if (best.size() == k && score <= best.front().first) continue;
+                    if (contained || intersects(child->m_bounds))
+                        cells.emplace(score, child);
+                }
+            }
+        }
+
+        std::sort_heap(best.begin(), best.end(), std::greater<Candidate>());
+        std::vector<const Node<T, D>*> result;
+        result.reserve(best.size());
+        for (const Candidate& candidate : best)
+            result.push_back(candidate.second);
+        return result;
+    }
+
+    template<typename T, unsigned D>
+    template<typename Generator>
+    inline std::vector<const Node<T, D>*> QuadTree<T, D>::sample(const Shape& range, size_t k, Generator& rng)
+    {
+        std::vector<const Node<T, D>*> drawn;
+
+        // A toroidal range also reaches the objects through the opposite edges
+        std::vector<Offset> offsets = m_toroidal ? images(range) : std::vector<Offset>(1, Offset{});
+        auto intersects = [&](const Bound& bound) {
+            for (const Offset& offset : offsets)
+                if (range.intersects(shifted(bound, offset))) return true;
+            return false;
+        };
+        auto contains = [&](const Bound& bound) {
+            for (const Offset& offset : offsets)
+                if (range.contains(shifted(bound, offset))) return true;
+            return false;
+        };
+
+        if (k == 0 || !intersects(m_bounds)) return drawn;
+
+        // Weigh the cells crossing the border of the range, a cell inside of it weighs its count
+        struct Weight {
+            size_t weight;
+            bool contained;
+        };
+        std::unordered_map<const QuadTree*, Weight> weights;
+        std::function<size_t(const QuadTree*)> weigh = [&](const QuadTree* cell) -> size_t {
+            if (!intersects(cell->m_bounds)) return 0;
+            if (contains(cell->m_bounds))
+            {
+                weights[cell] = { cell->m_count, true };
+                return cell->m_count;
+            }
+
+            size_t weight = cell->m_nodes.size();
+            if (!cell->m_isLeaf)
+            {
+                for (const QuadTree* child : cell->m_children)
+                    weight += weigh(child);
+            }
+            weights[cell] = { weight, false };
+            return weight;
+        };
+        if (weigh(this) == 0) return drawn;
+
+        auto weightOf = [&](const QuadTree* cell, bool insideRange) -> size_t {
+            if (insideRange) return cell->m_count;
+            auto it = weights.find(cell);
+            return it == weights.end() ? 0 : it->second.weight;
+        };
+
+        std::unordered_set<const Node<T, D>*> chosen;
+        size_t attempts = 16 * k + 64;
+        while (drawn.size() < k && attempts-- > 0)
+        {
+            // Descend from the root in proportion to the weights, down to a single entry of a bucket
+            const QuadTree* cell = this;
+            bool insideRange = weights[this].contained;
+            const Node<T, D>* node = nullptr;
+            while (cell && !node)
+            {
+                size_t r = std::uniform_int_distribution<size_t>(0, weightOf(cell, insideRange) - 1)(rng);
+                if (r < cell->m_nodes.size())
+                {
+                    node = cell->m_nodes[r].get();
+                    break;
+                }
+                r -= cell->m_nodes.size();
+
+                const QuadTree* next = nullptr;
+                if (!cell->m_isLeaf)
+                {
+                    for (const QuadTree* child : cell->m_children)
+                    {
+                        size_t weight = weightOf(child, insideRange);
+                        if (r < weight)
+                        {
+                            next = child;
+                            break;
+                        }
+                        r -= weight;
+                    }
+                }
+                if (next && !insideRange) insideRange = weights[next].contained;
+                cell = next;
+            }
+
+            if (!node || node->dead || chosen.count(node) || !intersects(node->bound)) continue;
+
+            // An object met in several buckets is kept once out of that many draws
+            size_t buckets = 0;
+            for (const QuadTree* bucket : node->qt)
+                buckets += intersects(bucket->m_bounds);
+            if (buckets > 1 && std::uniform_int_distribution<size_t>(0, buckets - 1)(rng) != 0) continue;
+
+            chosen.insert(node);
+            drawn.push_back(node);
+        }
+
+        if (drawn.size() < k)
+        {
+            // Too many rejections, draw the missing objects from the remaining matches
+            std::unordered_set<const Node<T, D>*> matches = query(range);
+            std::vector<const Node<T, D>*> remaining;
+            for (const Node<T, D>* node : matches)
+                if (!chosen.count(node)) remaining.push_back(node);
+
+            for (size_t i = 0; i < remaining.size() && drawn.size() < k; ++i)
+            {
+                std::swap(remaining[i], remaining[std::uniform_int_distribution<size_t>(i, remaining.size() - 1)(rng)]);
+                drawn.push_back(remaining[i]);
+            }
+        }
+
+        return drawn;
+    }
+
+    template<typename T, unsigned D>
+    inline typename QuadTree<T, D>::Numbering QuadTree<T, D>::number() const
+    {
+        // An object split between cells belongs to the first of its buckets
+        Numbering numbering;
+        std::vector<const QuadTree*> stack(1, this);
+        while (!stack.empty())
+        {
+            const QuadTree* cell = stack.back();
+            stack.pop_back();
+
+            size_t first = numbering.nodes.size();
+            for (const auto& node : cell->m_nodes)
+            {
+                if (node->dead || node->qt.front() != cell) continue;
+
+                std::array<double, D> center;
+                for (unsigned axis = 0; axis < D; ++axis)
+                    center[axis] = Space<D>::lower(node->bound, axis) + Space<D>::extent(node->bound, axis) / 2;
+
+                numbering.index.emplace(node.get(), numbering.nodes.size());
+                numbering.nodes.push_back(node.get());
+                numbering.centers.push_back(center);
+            }
+            if (numbering.nodes.size() > first)
+            {
+                numbering.cells.push_back(cell);
+                numbering.firstNode.push_back(first);
+            }
+
+            if (!cell->m_isLeaf)
+                stack.insert(stack.end(), std::begin(cell->m_children), std::end(cell->m_children));
+        }
+        numbering.firstNode.push_back(numbering.nodes.size());
+        return numbering;
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::candidates(const Numbering& numbering, size_t cell, double radius, std::vector<size_t>& found)
+    {
+        // The centers within the radius of the centers of the cell objects lie in the box around them
+        double lower[D], extent[D];
+        for (unsigned axis = 0; axis < D; ++axis)
+        {
+            double low = std::numeric_limits<double>::max(), high = std::numeric_limits<double>::lowest();
+            for (size_t i = numbering.firstNode[cell]; i < numbering.firstNode[cell + 1]; ++i)
+            {
+                low = std::min(low, numbering.centers[i][axis]);
+                high = std::max(high, numbering.centers[i][axis]);
+            }
+            lower[axis] = low - radius;
+            extent[axis] = high - low + 2 * radius;
+        }
+
+        found.clear();
+        for (const Node<T, D>* node : query(Space<D>::bound(lower, extent)))
+            found.push_back(numbering.index.at(node));
+        std::sort(found.begin(), found.end());
+    }
+
+    template<typename T, unsigned D>
+    inline double QuadTree<T, D>::squaredDistance(const std::array<double, D>& a, const std::array<double, D>& b) const noexcept
+    {
+        double squared = 0;
+        for (unsigned axis = 0; axis < D; ++axis)
+        {
+            double d = std::abs(a[axis] - b[axis]);
+            if (m_toroidal) d = std::min(d, Space<D>::extent(m_bounds, axis) - d);
+            squared += d * d;
+        }
+        return squared;
+    }
+
+    template<typename T, unsigned D>
+    template<typename Work>
+    inline void QuadTree<T, D>::parallel(const Numbering& numbering, unsigned threads, Work&& work)
+    {
+        // Split the cells in runs of consecutive subtrees holding about the same amount of objects
+        size_t cells = numbering.cells.size();
+        threads = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threads, cells)));
+        std::vector<size_t> bounds(1, 0);
+        for (unsigned t = 1; t < threads; ++t)
+        {
+            size_t target = numbering.nodes.size() * t / threads;
+            bounds.push_back(std::lower_bound(numbering.firstNode.begin() + bounds.back(), numbering.firstNode.end() - 1, target) - numbering.firstNode.begin());
+        }
+        bounds.push_back(cells);
+
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < threads; ++t)
+            workers.emplace_back([&work, &bounds, t]() { work(t, bounds[t], bounds[t + 1]); });
+        work(0u, bounds[0], bounds[1]);
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    template<typename T, unsigned D>
+    inline typename QuadTree<T, D>::NeighbourLists QuadTree<T, D>::buildNeighbourLists(double radius, unsigned threads)
+    {
+        Numbering numbering = number();
+
+        // The rows of consecutive runs of cells follow each other
+        struct Rows {
+            std::vector<size_t> counts;
+            std::vector<size_t> indices;
+        };
+        std::vector<Rows> runs(std::max(1u, threads));
+        parallel(numbering, threads, [&](unsigned run, size_t begin, size_t end) {
+            Rows& rows = runs[run];
+            std::vector<size_t> found;
+            for (size_t c = begin; c < end; ++c)
+            {
+                candidates(numbering, c, radius, found);
+                for (size_t i = numbering.firstNode[c]; i < numbering.firstNode[c + 1]; ++i)
+                {
+                    size_t count = 0;
+                    for (size_t j : found)
+                    {
+                        if (j != i && squaredDistance(numbering.centers[i], numbering.centers[j]) <= radius * radius)
+                        {
+                            rows.indices.push_back(j);
+                            count++;
+                        }
+                    }
+                    rows.counts.push_back(count);
+                }
+            }
+        });
+
+        NeighbourLists lists;
+        lists.offsets.reserve(numbering.nodes.size() + 1);
+        lists.offsets.push_back(0);
+        for (const Rows& rows : runs)
+        {
+            for (size_t count : rows.counts)
+                lists.offsets.push_back(lists.offsets.back() + count);
+            lists.indices.insert(lists.indices.end(), rows.indices.begin(), rows.indices.end());
+        }
+        lists.nodes = std::move(numbering.nodes);
+
+        return lists;
+    }
+
+    template<typename T, unsigned D>
+    inline typename QuadTree<T, D>::Clustering QuadTree<T, D>::dbscan(double eps, size_t minPoints, unsigned threads)
+    {
+        Numbering numbering = number();
+        size_t count = numbering.nodes.size();
+        const size_t none = std::numeric_limits<size_t>::max();
+
+        auto find = [](std::vector<size_t>& parent, size_t i) {
+            while (parent[i] != i)
+            {
+                parent[i] = parent[parent[i]];
+                i = parent[i];
+            }
+            return i;
+        };
+
+        // A cell is dense when the box around the centers of its objects is not wider than eps
+        std::vector<char> dense(numbering.cells.size(), 0);
+        for (size_t c = 0; c < numbering.cells.size(); ++c)
+        {
+            if (numbering.firstNode[c + 1] - numbering.firstNode[c] < minPoints) continue;
+
+            double squared = 0;
+            for (unsigned axis = 0; axis < D; ++axis)
+            {
+                double low = std::numeric_limits<double>::max(), high = std::numeric_limits<double>::lowest();
+                for (size_t i = numbering.firstNode[c]; i < numbering.firstNode[c + 1]; ++i)
+                {
+                    low = std::min(low, numbering.centers[i][axis]);
+                    high = std::max(high, numbering.centers[i][axis]);
+                }
+                squared += (high - low) * (high - low);
+            }
+            dense[c] = squared <= eps * eps;
+        }
+
+        // First pass, find the core objects, the objects of the dense cells are core without counting
+        std::vector<char> core(count, 0);
+        parallel(numbering, threads, [&](unsigned, size_t begin, size_t end) {
+            std::vector<size_t> found;
+            for (size_t c = begin; c < end; ++c)
+            {
+                if (dense[c])
+                {
+                    std::fill(core.begin() + numbering.firstNode[c], core.begin() + numbering.firstNode[c + 1], 1);
+                    continue;
+                }
+
+                candidates(numbering, c, eps, found);
+                for (size_t i = numbering.firstNode[c]; i < numbering.firstNode[c + 1]; ++i)
+                {
+                    size_t neighbours = 0;
+                    for (size_t j = 0; j < found.size() && neighbours < minPoints; ++j)
+                        neighbours += squaredDistance(numbering.centers[i], numbering.centers[found[j]]) <= eps * eps;
+                    core[i] = neighbours >= minPoints;
+                }
+            }
+        });
+
+        // Second pass, every run joins its core objects to their core neighbours in a forest of its own,
+        // and attaches its other objects to a core neighbour
+        std::vector<std::vector<size_t>> forests(std::max(1u, threads));
+        std::vector<size_t> attached(count, none);
+        parallel(numbering, threads, [&](unsigned run, size_t begin, size_t end) {
+            std::vector<size_t>& parent = forests[run];
+            parent.resize(count);
+            for (size_t i = 0; i < count; ++i)
+                parent[i] = i;
+
+            std::vector<size_t> found;
+            for (size_t c = begin; c < end; ++c)
+            {
+                size_t first = numbering.firstNode[c], last = numbering.firstNode[c + 1];
+                if (dense[c])
+                {
+                    for (size_t i = first + 1; i < last; ++i)
+                        parent[find(parent, i)] = find(parent, first);
+                }
+
+                candidates(numbering, c, eps, found);
+                for (size_t i = first; i < last; ++i)
+                {
+                    for (size_t j : found)
+                    {
+                        // Within a dense cell the objects are already joined
+                        if (!core[j] || (dense[c] && j >= first && j < last)) continue;
+                        if (squaredDistance(numbering.centers[i], numbering.centers[j]) > eps * eps) continue;
+
+                        if (!core[i])
+                        {
+                            attached[i] = j;
+                            break;
+                        }
+
+                        size_t a = find(parent, i), b = find(parent, j);
+                        if (a != b) parent[std::max(a, b)] = std::min(a, b);
+                    }
+                }
+            }
+        });
+
+        // Merge the forests of the runs
+        std::vector<size_t>& parent = forests[0];
+        for (size_t run = 1; run < forests.size(); ++run)
+        {
+            if (forests[run].empty()) continue;
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                size_t a = find(parent, i), b = find(parent, find(forests[run], i));
+                if (a != b) parent[std::max(a, b)] = std::min(a, b);
+            }
+        }
+
+        // Number the clusters in the order of their first object
+        Clustering clustering;
+        clustering.labels.assign(count, -1);
+        std::vector<int> label(count, -1);
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!core[i]) continue;
+
+            size_t root = find(parent, i);
+            if (label[root] < 0) label[root] = static_cast<int>(clustering.clusters++);
+            clustering.labels[i] = label[root];
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!core[i] && attached[i] != none)
+                clustering.labels[i] = clustering.labels[attached[i]];
+        }
+        clustering.nodes = std::move(numbering.nodes);
+
+        return clustering;
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::query(const Shape& range, std::unordered_set<const Node<T, D>*>& foundObjects, Mask mask)
+    {
+        if (!(m_mask & mask) || !range.intersects(m_bounds)) return;
+
+        if (range.contains(m_bounds))
+        {
+            for (const auto& node : m_nodes)
+            {
+                if (!node->dead && (node->mask & mask))
+                    foundObjects.insert(node.get());
+            }
+        }
+        else
+        {
+            for (const auto& node : m_nodes)
+            {
+                if (!node->dead && (node->mask & mask) && range.intersects(node->bound))
+                {
+                    foundObjects.insert(node.get());
+                }
+            }
+        }
+        if (!m_isLeaf)
+        {
+            // Get objects from leaves
+            for (QuadTree* leaf : m_children)
+            {
+                leaf->query(range, foundObjects, mask);
+            }
+        }
+    }
+
+    template<typename T, unsigned D>
+    inline const std::unordered_set<const Node<T, D>*>& QuadTree<T, D>::cachedQuery(const Bound& range)
+    {
+        std::array<double, 2 * D> key;
+        for (unsigned axis = 0; axis < D; ++axis)
+        {
+            key[axis] = Space<D>::lower(range, axis);
+            key[D + axis] = Space<D>::extent(range, axis);
+        }
+
+        RootState& root = state();
+        auto it = root.queryCache.find(key);
+        if (it != root.queryCache.end() && validate(it->second))
+            return it->second.result;
+
+        if (it == root.queryCache.end())
+        {
+            if (root.queryCache.size() >= root.queryCacheSize) root.queryCache.clear();
+            it = root.queryCache.emplace(key, CachedQuery()).first;
+        }
+
+        CachedQuery& cached = it->second;
+        cached.result.clear();
+        cached.checks.clear();
+        cachedQuery(range, m_toroidal ? images(range) : std::vector<Offset>(1, Offset{}), cached);
+        return cached.result;
+    }
+
+    template<typename T, unsigned D>
+    inline bool QuadTree<T, D>::validate(const CachedQuery& cached) const noexcept
+    {
+        for (const auto& check : cached.checks)
+        {
+            // A merge changes the version of the merged cell, which is checked before its deleted children
+            size_t version = check.subtree ? check.cell->m_subtreeVersion : check.cell->m_version;
+            if (version != check.version) return false;
+        }
+        return true;
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::cachedQuery(const Bound& range, const std::vector<Offset>& offsets, CachedQuery& cached) const
+    {
+        bool intersects = false, contained = false;
+        for (const Offset& offset : offsets)
+        {
+            Bound image = shifted(m_bounds, offset);
+            intersects = intersects || range.intersects(image);
+            contained = contained || range.contains(image);
+        }
+        if (!intersects) return;
+
+        if (contained)
+        {
+            cached.checks.push_back({ this, m_subtreeVersion, true });
+            collect(cached.result);
+            return;
+        }
+
+        cached.checks.push_back({ this, m_version, false });
+        for (const auto& node : m_nodes)
+        {
+            if (node->dead) continue;
+
+            bool found = false;
+            for (size_t i = 0; i < offsets.size() && !found; ++i)
+                found = range.intersects(shifted(node->bound, offsets[i]));
+
+            if (found) cached.result.insert(node.get());
+        }
+
+        if (!m_isLeaf)
+        {
+            for (const QuadTree* child : m_children)
+                child->cachedQuery(range, offsets, cached);
+        }
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::collect(std::unordered_set<const Node<T, D>*>& foundObjects) const
+    {
+        for (const auto& node : m_nodes)
+        {
+            if (!node->dead)
+                foundObjects.insert(node.get());
+        }
+
+        if (!m_isLeaf)
+        {
+            for (const QuadTree* child : m_children)
+                child->collect(foundObjects);
+        }
+    }
+
+    /** Cursor implementation */
+    template<typename T, unsigned D>
+    inline QuadTree<T, D>::Cursor::Cursor(const QuadTree& tree, const Shape& range) :
+        m_root(&tree),
+        m_range(&range)
+    {
+        if (tree.m_toroidal) m_offsets = tree.images(range);
+        if (!tree.m_toroidal || !m_offsets.empty()) enter(m_root);
+    }
+
+    template<typename T, unsigned D>
+    inline const Node<T, D>* QuadTree<T, D>::Cursor::next()
+    {
+        while (m_cell)
+        {
+            const auto& nodes = m_cell->m_nodes;
+            while (m_index < nodes.size())
+            {
+                const Node<T, D>* node = nodes[m_index++].get();
+                if (node->dead) continue;
+                if (!m_contained && !intersects(node->bound)) continue;
+                if (!owns(*node)) continue;
+
+                return node;
+            }
+
+            advance();
+        }
+
+        return nullptr;
+    }
+
+    template<typename T, unsigned D>
+    inline bool QuadTree<T, D>::Cursor::enter(const QuadTree* cell)
+    {
+        if (!intersects(cell->m_bounds)) return false;
+
+        m_cell = cell;
+        m_index = 0;
+        m_contained = m_offsets.empty() && m_range->contains(cell->m_bounds);
+        for (size_t i = 0; i < m_offsets.size() && !m_contained; ++i)
+            m_contained = m_range->contains(shifted(cell->m_bounds, m_offsets[i]));
+        return true;
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::Cursor::advance()
+    {
+        // Descend into the first child that intersects the range
+        if (!m_cell->m_isLeaf)
+        {
+            for (const QuadTree* child : m_cell->m_children)
+                if (enter(child)) return;
+        }
+
+        // Otherwise move to the next sibling, climbing up when there are none left
+        while (m_cell != m_root)
+        {
+            const QuadTree* parent = m_cell->m_parent;
+            auto it = std::find(std::begin(parent->m_children), std::end(parent->m_children), m_cell);
+            for (++it; it != std::end(parent->m_children); ++it)
+                if (enter(*it)) return;
+
+            m_cell = parent;
+        }
+
+        m_cell = nullptr;
+    }
+
+    template<typename T, unsigned D>
+    inline bool QuadTree<T, D>::Cursor::owns(const Node<T, D>& node) const
+    {
+        if (node.qt.size() == 1) return true;
+
+        // All the buckets that intersect the range are visited, the first of them reports the node
+        for (const QuadTree* bucket : node.qt)
+        {
+            if (bucket == m_cell) return true;
+            if (intersects(bucket->m_bounds)) return false;
+        }
+        return false;
+    }
+
+    template<typename T, unsigned D>
+    inline bool QuadTree<T, D>::Cursor::intersects(const Bound& bound) const
+    {
+        if (m_offsets.empty()) return m_range->intersects(bound);
+
+        for (const auto& offset : m_offsets)
+            if (m_range->intersects(shifted(bound, offset))) return true;
+        return false;
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::clear() noexcept {
+        forgetChanges();
+        discard();
+        touch();
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::discard() noexcept {
+        m_nodes.clear();
+        if (m_state) m_state->deadBuckets.clear();
+        m_hasDead = false;
+
+        // The children are cleared by their destructors, only the top of the cleared subtree is touched
+        if (!m_isLeaf) {
+            for (QuadTree* child : m_children)
+                destroy(child);
+
+            m_isLeaf = true;
+        }
+        m_count = 0;
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::release() noexcept {
+        if (!m_resource->isMonotonic())
+        {
+            clear();
+            return;
+        }
+
+        // Abandon the nodes and the children in the arena, their destructors are never run
+        new (&m_nodes) decltype(m_nodes)(Allocator<std::shared_ptr<Node<T, D>>>(m_resource));
+        std::fill(std::begin(m_children), std::end(m_children), nullptr);
+        forgetChanges();
+        if (m_state)
+        {
+            m_state->deadBuckets.clear();
+
+            // The regions of the observers are in the arena too, they are placed again by the next updateSubscriptions()
+            if (m_state->regions)
+            {
+                m_state->regions->release();
+                for (auto& observer : m_state->observers)
+                {
+                    observer.second.entries.clear();
+                    m_state->movedObservers.insert(observer.first);
+                }
+            }
+        }
+        m_hasDead = false;
+        m_isLeaf = true;
+        m_count = 0;
+        touch();
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::touch() noexcept {
+        m_version++;
+
+        // The owned objects, the layers, the highest score and the expanding bound are gathered again up the path,
+        // until a cell ends up with the same ones
+        bool remask = true;
+        for (QuadTree* cell = this; cell; cell = cell->m_parent)
+        {
+            cell->m_subtreeVersion++;
+            if (cell->m_snapshot) cell->m_snapshot.reset();
+
+            if (!remask) continue;
+
+            size_t owned = 0, strays = 0;
+            Mask mask = 0;
+            for (const auto& node : cell->m_nodes)
+            {
+                if (node->dead) continue;
+                if (node->qt.front() == cell)
+                {
+                    owned++;
+                    if (!cell->centers(node->bound)) strays++;
+                }
+                mask |= node->mask;
+            }
+
+            if (!cell->m_isLeaf) {
+                for (const QuadTree* child : cell->m_children)
+                {
+                    owned += child->m_owned;
+                    strays += child->m_strays;
+                    mask |= child->m_mask;
+                }
+            }
+
+            remask = owned != cell->m_owned || strays != cell->m_strays || mask != cell->m_mask;
+            cell->m_owned = owned;
+            cell->m_strays = strays;
+            cell->m_mask = mask;
+
+            if (cell->m_scored && cell->fitScore()) remask = true;
+
+            if (cell->m_moving && cell->fitMotion()) remask = true;
+        }
+    }
 
-        /** query
-         * 
-         * Query the Quadtree with a given range, this will return all the objects in the quadtree with a bound that intersects the given range
-         * 
-         * \param range     A shape that will be used to query the Quadtree
-         * \return          A set of unique elements which their bound intersects the given range
-         */
-        inline std::unordered_set<const Node<T>*> query(const Shape& range);
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::touchInserted(const Node<T, D>& node) noexcept {
+        m_version++;
 
-        /** draw
-         * 
-         * Draw the quadtree using a callback function that accepts Rect and returns void
-         * 
-         * Example usage:
-         * draw([](Rect& rect){ awesome_draw_rectangle_function(rect.x, rect.y, rect.width, rect.height); })
-         * 
-         * \param func      A callback function to draw the quadtree with
-         */
-        inline void draw(std::function<void(const Rect&)> func) const;
+        // A new object only widens what the cells up the path gather, so they are extended instead of gathered again.
+        // Every bucket of it is counted, it is owned by the first leaf it went into
+        bool owner = node.qt.size() == 1;
+        bool stray = owner && !centers(node.bound);
+        for (QuadTree* cell = this; cell; cell = cell->m_parent)
+        {
+            cell->m_subtreeVersion++;
+            if (cell->m_snapshot) cell->m_snapshot.reset();
+            cell->m_count++;
 
-        /** clear
-         * 
-         * Clear the quadtree and it's children recursively
-         * 
-         * \return 
-         */
-        inline void clear() noexcept;
+            if (owner) cell->m_owned++;
+            if (stray) cell->m_strays++;
+            cell->m_mask |= node.mask;
+            if (cell->m_scored) cell->m_summary->maxScore = std::max(cell->m_summary->maxScore, node.score);
 
-        ~QuadTree();
-    private:
-        QuadTree() = delete;
-        bool insert(std::shared_ptr<Node<T>> node);
-        void subdivide();
-        void discardEmptyBuckets();
-        void query(const Shape& range, std::unordered_set<const Node<T>*>& foundObjects);
-    private:
-        bool         m_isLeaf = true;
-        unsigned int m_level = 0;
-        unsigned int m_capacity;
-        Rect         m_bounds;
-        QuadTree* m_parent = nullptr;
-        QuadTree* m_children[4] = { nullptr, nullptr, nullptr, nullptr };
-        std::vector<std::shared_ptr<Node<T>>> m_nodes;
-    };
+            if (!cell->m_moving) continue;
 
-    /** Quadtree implementation  */
-    template<typename T>
-    inline QuadTree<T>::QuadTree(const Rect& _bound, unsigned _capacity) :
-        m_bounds(_bound),
-        m_capacity(_capacity)
-    {
-        m_nodes.reserve(_capacity);
+            Summary& summary = *cell->m_summary;
+            for (unsigned axis = 0; axis < D; ++axis)
+            {
+                double velocity = node.velocity[axis];
+                double position = Space<D>::lower(node.bound, axis) + velocity * (summary.time - node.time);
+                summary.lower[axis] = std::min(summary.lower[axis], position);
+                summary.upper[axis] = std::max(summary.upper[axis], position + Space<D>::extent(node.bound, axis));
+                summary.minVelocity[axis] = std::min(summary.minVelocity[axis], velocity);
+                summary.maxVelocity[axis] = std::max(summary.maxVelocity[axis], velocity);
+            }
+        }
     }
 
-    template<typename T>
-    inline bool QuadTree<T>::insert(std::shared_ptr<Node<T>> node)
-    {
-        if (!m_bounds.intersects(node->bound)) return false;
+    template<typename T, unsigned D>
+    inline Snapshot<T, D> QuadTree<T, D>::snapshot() const {
+        if (m_snapshot) return Snapshot<T, D>(m_snapshot);
 
-        // Subdivide if required
-        if (m_isLeaf && m_nodes.size() >= m_capacity) {
-            subdivide();
-        }
+        // An arena abandons the snapshot cells with the quadtree cells, which would leak heap memory
+        using Cell = typename Snapshot<T, D>::Cell;
+        MemoryResource* resource = m_resource->isMonotonic() ? m_resource : defaultResource();
+        auto cell = std::allocate_shared<Cell>(Allocator<Cell>(resource), m_bounds, resource);
+        cell->isLeaf = m_isLeaf;
+
+        // The bounds are copied, the quadtree keeps moving its nodes in place
+        cell->objects.reserve(m_nodes.size());
+        for (const auto& node : m_nodes)
+            if (!node->dead)
+                cell->objects.push_back({ node.get(), node->data, node->bound });
 
-        // insert object into it's leaves
         if (!m_isLeaf) {
-            m_children[0]->insert(node);
-            m_children[1]->insert(node);
-            m_children[2]->insert(node);
-            m_children[3]->insert(node);
-        }
-        else 
-        {
-            LOG_DEBUG("Insert node: " << &*node.get() << " Holding Point: " << node->data);
-            m_nodes.push_back(node);
-            node->qt.emplace_back(this);
+            for (unsigned i = 0; i < Children; ++i)
+                cell->children[i] = m_children[i]->snapshot().m_root;
         }
 
-        return true;
+        m_snapshot = cell;
+        return Snapshot<T, D>(m_snapshot);
     }
 
-    template<typename T>
-    inline bool QuadTree<T>::remove(const Node<T>& node)
+    /** Snapshot implementation */
+    template<typename T, unsigned D>
+    inline std::vector<typename Snapshot<T, D>::Object> Snapshot<T, D>::query(const Shape& range) const
     {
-        for (auto t : node.qt)
+        std::unordered_set<const Node<T, D>*> found;
+        std::vector<Object> objects;
+        if (m_root) query(*m_root, range, found, objects);
+        return objects;
+    }
+
+    template<typename T, unsigned D>
+    inline void Snapshot<T, D>::query(const Cell& cell, const Shape& range, std::unordered_set<const Node<T, D>*>& found, std::vector<Object>& objects)
+    {
+        if (!range.intersects(cell.bounds)) return;
+
+        // An object split between cells is reported once
+        bool contained = range.contains(cell.bounds);
+        for (const Object& object : cell.objects)
         {
-            auto& nodes = t->m_nodes;
-            nodes.erase(std::find_if(nodes.begin(), nodes.end(), [&](const auto& other) { return other.get() == &node; }));
-            t->discardEmptyBuckets();
+            if ((contained || range.intersects(object.bound)) && found.insert(object.node).second)
+                objects.push_back(object);
         }
 
-        
-        return true;
+        if (!cell.isLeaf)
+        {
+            for (const auto& child : cell.children)
+                query(*child, range, found, objects);
+        }
     }
 
-    template<typename T>
-    inline std::unordered_set<const Node<T>*> QuadTree<T>::query(const Shape& range)
-    {
-        std::unordered_set<const Node<T>*> foundObjects;
-        query(range, foundObjects);
-        return foundObjects;
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::destroy(QuadTree* cell) noexcept {
+        cell->~QuadTree();
+        m_resource->deallocate(cell, sizeof(QuadTree), alignof(QuadTree));
     }
 
-    template<typename T>
-    inline void QuadTree<T>::query(const Shape& range, std::unordered_set<const Node<T>*>& foundObjects)
-    {
-        if (!range.intersects(m_bounds)) return;
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::grow(const Bound& toward) {
+        // Move the content of the root into a new cell, which becomes one of the children of the grown root
+        void* memory = m_resource->allocate(sizeof(QuadTree), alignof(QuadTree));
+        QuadTree* moved = new (memory) QuadTree(m_bounds, m_capacity, m_resource);
+        moved->m_mergeThreshold = m_mergeThreshold;
+        moved->m_level = m_level;
+        moved->m_parent = this;
+        moved->m_isLeaf = m_isLeaf;
+        moved->m_hasDead = m_hasDead;
+        moved->m_count = m_count;
+        moved->m_owned = m_owned;
+        moved->m_strays = m_strays;
+        moved->m_mask = m_mask;
+        moved->m_scored = m_scored;
+        moved->m_moving = m_moving;
+        moved->reserveSummary();
+        if (m_summary) *moved->m_summary = *m_summary;
+        moved->m_version = m_version;
+        moved->m_subtreeVersion = m_subtreeVersion;
+        moved->m_snapshot = std::move(m_snapshot);
+        moved->m_nodes.swap(m_nodes);
 
-        if (range.contains(m_bounds))
-        {
-            for (const auto& node : m_nodes)
-            {
-                foundObjects.insert(node.get());
+        for (const auto& node : moved->m_nodes)
+            std::replace(node->qt.begin(), node->qt.end(), this, moved);
+
+        if (m_state) std::replace(m_state->deadBuckets.begin(), m_state->deadBuckets.end(), this, moved);
+
+        if (!m_isLeaf) {
+            for (unsigned i = 0; i < Children; ++i) {
+                moved->m_children[i] = m_children[i];
+                m_children[i]->m_parent = moved;
             }
         }
-        else
-        {
-            for (const auto& node : m_nodes)
-            {
-                if (range.intersects(node->bound))
-                {
-                    foundObjects.insert(node.get());
-                }
+
+        // Double the bounds on every axis, towards the object
+        unsigned index = 0;
+        double lower[D], extent[D];
+        for (unsigned axis = 0; axis < D; ++axis) {
+            lower[axis] = Space<D>::lower(m_bounds, axis);
+            extent[axis] = Space<D>::extent(m_bounds, axis);
+            if (Space<D>::lower(toward, axis) < lower[axis]) {
+                lower[axis] -= extent[axis];
+                index |= 1u << axis;
             }
         }
-        if (!m_isLeaf) 
-        {
-            // Get objects from leaves
-            for (QuadTree* leaf : m_children) 
-            {
-                leaf->query(range, foundObjects);
+
+        // The old root keeps its exact bounds, the siblings are built like in subdivide
+        double childLower[D];
+        for (unsigned i = 0; i < Children; ++i) {
+            if (i == index) {
+                m_children[i] = moved;
+                continue;
             }
+
+            for (unsigned axis = 0; axis < D; ++axis)
+                childLower[axis] = lower[axis] + ((i >> axis) & 1 ? extent[axis] : 0);
+
+            void* siblingMemory = m_resource->allocate(sizeof(QuadTree), alignof(QuadTree));
+            m_children[i] = new (siblingMemory) QuadTree(Space<D>::bound(childLower, extent), m_capacity, m_resource);
+            m_children[i]->m_level = m_level;
+            m_children[i]->m_mergeThreshold = m_mergeThreshold;
+            m_children[i]->m_scored = m_scored;
+            m_children[i]->m_moving = m_moving;
+            m_children[i]->m_parent = this;
+            m_children[i]->reserveSummary();
+            if (m_summary) m_children[i]->m_summary->time = m_summary->time;
         }
+
+        for (unsigned axis = 0; axis < D; ++axis)
+            extent[axis] *= 2;
+
+        LOG_DEBUG("Grow root: " << this << " Towards child: " << index);
+        m_bounds = Space<D>::bound(lower, extent);
+        m_level--;
+        m_isLeaf = false;
+        m_hasDead = false;
+        touch();
     }
 
-    template<typename T>
-    inline void QuadTree<T>::clear() noexcept {
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::subdivide() {
+        double lower[D], extent[D];
+        for (unsigned axis = 0; axis < D; ++axis)
+            extent[axis] = Space<D>::extent(m_bounds, axis) * 0.5f;
+
+        // Child i takes the upper half of an axis when the axis bit is set in i
+        for (unsigned i = 0; i < Children; ++i) {
+            for (unsigned axis = 0; axis < D; ++axis)
+                lower[axis] = Space<D>::lower(m_bounds, axis) + ((i >> axis) & 1 ? extent[axis] : 0);
+
+            void* memory = m_resource->allocate(sizeof(QuadTree), alignof(QuadTree));
+            m_children[i] = new (memory) QuadTree(Space<D>::bound(lower, extent), m_capacity, m_resource);
+            m_children[i]->m_level = m_level + 1;
+            m_children[i]->m_mergeThreshold = m_mergeThreshold;
+            m_children[i]->m_scored = m_scored;
+            m_children[i]->m_moving = m_moving;
+            m_children[i]->m_parent = this;
+            m_children[i]->reserveSummary();
+            if (m_summary) m_children[i]->m_summary->time = m_summary->time;
+        }
+        m_isLeaf = false;
+
+        // The children are empty so the aggregates stay the same, only the versions and the snapshots change up the path
+        m_version++;
+        for (QuadTree* cell = this; cell; cell = cell->m_parent)
+        {
+            cell->m_subtreeVersion++;
+            if (cell->m_snapshot) cell->m_snapshot.reset();
+        }
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::recount() noexcept {
+        m_count = m_nodes.size();
+
+        if (!m_isLeaf) {
+            for (QuadTree* child : m_children)
+                m_count += child->m_count;
+        }
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::collapse(QuadTree* target) {
+        // Move the nodes into the target, a node split between several cells is moved only once.
+        // The target takes the place of the cell among the buckets, so a node owned by the cell is owned by the target
+        for (auto& node : m_nodes)
+        {
+            auto& qt = node->qt;
+            if (std::find(qt.begin(), qt.end(), target) == qt.end())
+            {
+                std::replace(qt.begin(), qt.end(), this, target);
+                target->m_nodes.push_back(std::move(node));
+            }
+            else
+            {
+                qt.erase(std::remove(qt.begin(), qt.end(), this), qt.end());
+            }
+        }
         m_nodes.clear();
 
         if (!m_isLeaf) {
             for (QuadTree* child : m_children)
-                child->clear();
+                child->collapse(target);
 
-            delete m_children[0];
-            delete m_children[1];
-            delete m_children[2];
-            delete m_children[3];
+            for (QuadTree* child : m_children)
+                destroy(child);
 
             m_isLeaf = true;
         }
     }
 
-    template<typename T>
-    inline void QuadTree<T>::subdivide() {
-        double width = m_bounds.width * 0.5f;
-        double height = m_bounds.height * 0.5f;
-        double x = 0, y = 0;
-        for (int i = 0; i < 4; ++i) {
-            switch (i) {
-            case 0: x = m_bounds.x + width; y = m_bounds.y; break; // Top right
-            case 1: x = m_bounds.x;         y = m_bounds.y; break; // Top left
-            case 2: x = m_bounds.x;         y = m_bounds.y + height; break; // Bottom left
-            case 3: x = m_bounds.x + width; y = m_bounds.y + height; break; // Bottom right
-            }
-            m_children[i] = new QuadTree({ x, y, width, height }, m_capacity);
-            m_children[i]->m_level = m_level + 1;
-            m_children[i]->m_parent = this;
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::discardEmptyBuckets(const std::vector<QuadTree*>& buckets) {
+        // Recount the paths from the modified buckets up to the root
+        for (QuadTree* bucket : buckets)
+            for (QuadTree* cell = bucket; cell; cell = cell->m_parent)
+                cell->recount();
+
+        // Find the highest cell on every path which fell below the merge threshold, empty subtrees are always merged
+        std::vector<QuadTree*> merges;
+        for (QuadTree* bucket : buckets)
+        {
+            QuadTree* merge = nullptr;
+            for (QuadTree* cell = bucket; cell; cell = cell->m_parent)
+                if (!cell->m_isLeaf && cell->m_count < std::max(cell->m_mergeThreshold, 1u))
+                    merge = cell;
+
+            if (merge && std::find(merges.begin(), merges.end(), merge) == merges.end())
+                merges.push_back(merge);
+        }
+
+        // Skip cells that will be deleted by the merge of one of their ancestors
+        merges.erase(std::remove_if(merges.begin(), merges.end(), [&](QuadTree* merge) {
+            for (QuadTree* cell = merge->m_parent; cell; cell = cell->m_parent)
+                if (std::find(merges.begin(), merges.end(), cell) != merges.end())
+                    return true;
+            return false;
+        }), merges.end());
+
+        // Redistribute the survivors into the merged cell
+        for (QuadTree* merge : merges)
+        {
+            LOG_DEBUG("Merge cell: " << merge << " Holding: " << merge->m_count);
+            for (QuadTree* child : merge->m_children)
+                child->collapse(merge);
+
+            for (QuadTree* child : merge->m_children)
+                merge->destroy(child);
+
+            merge->m_isLeaf = true;
+            merge->touch();
+
+            for (QuadTree* cell = merge; cell; cell = cell->m_parent)
+                cell->recount();
         }
-        m_isLeaf = false;
     }
 
-    template<typename T>
-    inline void QuadTree<T>::discardEmptyBuckets() {
-        if (!m_nodes.empty()) return;
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::setDeferredRemoval(bool deferred)
+    {
+        if (!deferred) compact();
+        m_deferRemoval = deferred;
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::compact()
+    {
+        if (!m_state || m_state->deadBuckets.empty()) return;
+
+        // Every bucket is compacted once, no matter how many of its nodes died
+        std::vector<QuadTree*>& deadBuckets = m_state->deadBuckets;
+        for (QuadTree* bucket : deadBuckets)
+        {
+            auto& nodes = bucket->m_nodes;
+            nodes.erase(std::remove_if(nodes.begin(), nodes.end(), [](const auto& node) { return node->dead; }), nodes.end());
+            bucket->m_hasDead = false;
+        }
+
+        discardEmptyBuckets(deadBuckets);
+        deadBuckets.clear();
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::setMergeThreshold(unsigned threshold) noexcept {
+        m_mergeThreshold = std::min(threshold, m_capacity);
+
         if (!m_isLeaf) {
             for (QuadTree* child : m_children)
-                if (!child->m_isLeaf || !child->m_nodes.empty())
-                    return;
+                child->setMergeThreshold(threshold);
         }
+    }
 
-        clear();
-
-        if (m_parent) m_parent->discardEmptyBuckets();
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::draw(std::function<void(const Bound&)> func) const
+    {
+        draw(m_bounds, std::numeric_limits<unsigned>::max(), func);
     }
 
-    template<typename T>
-    inline void QuadTree<T>::draw(std::function<void(const Rect&)> func) const
+    template<typename T, unsigned D>
+    template<typename Func>
+    inline void QuadTree<T, D>::draw(const Bound& viewport, unsigned maxDepth, Func&& func) const
     {
+        if (!viewport.intersects(m_bounds)) return;
+
         func(m_bounds);
 
-        if (!m_isLeaf) {
+        if (!m_isLeaf && maxDepth > 0) {
             for (QuadTree* child : m_children)
             {
-                child->draw(func);
+                child->draw(viewport, maxDepth - 1, func);
             }
         }
     }
 
-    template<typename T>
-    inline QuadTree<T>::~QuadTree() {
-        clear();
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::heatmap(const Bound& area, size_t width, size_t height, std::vector<size_t>& grid) const
+    {
+        grid.assign(width * height, 0);
+        if (width == 0 || height == 0) return;
+
+        const size_t bins[2] = { width, height };
+        rasterize(area, bins, grid);
+    }
+
+    template<typename T, unsigned D>
+    inline void QuadTree<T, D>::rasterize(const Bound& area, const size_t* bins, std::vector<size_t>& grid) const
+    {
+        // Every object is binned by its center, which lies in the cell owning it unless the subtree holds strays
+        if (!m_strays && !area.intersects(m_bounds)) return;
+
+        // The bins spanned by the cell on the X and Y axes
+        size_t first[2], last[2];
+        for (unsigned axis = 0; axis < 2; ++axis)
+        {
+            double size = Space<D>::extent(area, axis) / bins[axis];
+            double lower = (Space<D>::lower(m_bounds, axis) - Space<D>::lower(area, axis)) / size;
+            double upper = lower + Space<D>::extent(m_bounds, axis) / size;
+            first[axis] = static_cast<size_t>(std::min(std::max(std::floor(lower), 0.0), double(bins[axis] - 1)));
+            last[axis] = static_cast<size_t>(std::min(std::max(std::ceil(upper) - 1, 0.0), double(bins[axis] - 1)));
+        }
+
+        bool single = !m_strays && first[0] == last[0] && first[1] == last[1];
+        for (unsigned axis = 0; axis < D && single; ++axis)
+        {
+            single = Space<D>::lower(m_bounds, axis) >= Space<D>::lower(area, axis) &&
+                Space<D>::lower(m_bounds, axis) + Space<D>::extent(m_bounds, axis) <= Space<D>::lower(area, axis) + Space<D>::extent(area, axis);
+        }
+
+        if (single)
+        {
+            grid[first[1] * bins[0] + first[0]] += m_owned;
+            return;
+        }
+
+        for (const auto& node : m_nodes)
+        {
+            size_t bin[2];
+            bool inside = true;
+            for (unsigned axis = 0; axis < D && inside; ++axis)
+            {
+                double center = Space<D>::lower(node->bound, axis) + Space<D>::extent(node->bound, axis) / 2;
+                double offset = center - Space<D>::lower(area, axis);
+                inside = offset >= 0 && offset <= Space<D>::extent(area, axis);
+                if (axis < 2)
+                    bin[axis] = std::min(static_cast<size_t>(offset / Space<D>::extent(area, axis) * bins[axis]), bins[axis] - 1);
+            }
+
+            // An object split between cells is counted by its first bucket only
+            if (inside && !node->dead && node->qt.front() == this) grid[bin[1] * bins[0] + bin[0]]++;
+        }
+
+        if (!m_isLeaf)
+        {
+            for (const QuadTree* child : m_children)
+                child->rasterize(area, bins, grid);
+        }
+    }
+
+    template<typename T, unsigned D>
+    inline bool QuadTree<T, D>::centers(const Bound& bound) const noexcept
+    {
+        // Half open like the bins, a center on the upper edge belongs to the next cell
+        for (unsigned axis = 0; axis < D; ++axis)
+        {
+            double center = Space<D>::lower(bound, axis) + Space<D>::extent(bound, axis) / 2;
+            if (center < Space<D>::lower(m_bounds, axis) || center >= Space<D>::lower(m_bounds, axis) + Space<D>::extent(m_bounds, axis))
+                return false;
+        }
+        return true;
+    }
+
+    template<typename T, unsigned D>
+    inline QuadTree<T, D>::~QuadTree() {
+        discard();
+        if (m_summary) (m_parent ? m_resource : defaultResource())->deallocate(m_summary, sizeof(Summary), alignof(Summary));
     }
 
     /** Circle implementation */
-    inline bool Circle::intersects(const Rect& other) const noexcept 
+    inline bool Circle::intersects(const Rect& other) const noexcept
     {
-        double dx = abs(x - (other.x + other.width / 2));
-        double dy = abs(y - (other.y + other.height / 2));
+        double dx = std::abs(x - (other.x + other.width / 2));
+        double dy = std::abs(y - (other.y + other.height / 2));
 
         if (dx > (other.width / 2 + radius)) { return false; }
         if (dy > (other.height / 2 + radius)) { return false; }
@@ -418,19 +3734,103 @@ namespace qtree
         if (dx <= (other.width / 2)) { return true; }
         if (dy <= (other.height / 2)) { return true; }
 
-        return ((dx - other.width / 2) * (dx - other.width / 2) + 
+        return ((dx - other.width / 2) * (dx - other.width / 2) +
             (dy - other.height / 2) * (dy - other.height / 2) <= (radius * radius));
     }
 
     inline bool Circle::contains(const Rect& other) const noexcept
     {
-        double dx = std::max(abs(x - other.x - other.width / 2), abs(other.x + other.width / 2 - x));
-        double dy = std::max(abs(y - other.y + other.height / 2), abs(other.y - other.height / 2 - y));
+        // The farthest corner of the rect has to be inside the circle
+        double dx = std::max(std::abs(x - other.x), std::abs(other.x + other.width - x));
+        double dy = std::max(std::abs(y - other.y), std::abs(other.y + other.height - y));
         return (radius * radius) >= (dx * dx) + (dy * dy);
     }
 
+    /** GeoCircle implementation */
+    inline bool GeoCircle::intersects(const Rect& other) const noexcept
+    {
+        return minAngle(longitude, latitude, other) * sphereRadius <= radius;
+    }
+
+    inline bool GeoCircle::contains(const Rect& other) const noexcept
+    {
+        return maxAngle(longitude, latitude, other) * sphereRadius <= radius;
+    }
+
+    inline double GeoCircle::angle(double longitude1, double latitude1, double longitude2, double latitude2) noexcept
+    {
+        const double degree = 3.14159265358979323846 / 180;
+        double sinLatitude = std::sin((latitude2 - latitude1) * degree / 2);
+        double sinLongitude = std::sin((longitude2 - longitude1) * degree / 2);
+        double h = sinLatitude * sinLatitude + std::cos(latitude1 * degree) * std::cos(latitude2 * degree) * sinLongitude * sinLongitude;
+        return 2 * std::asin(std::sqrt(std::min(h, 1.0)));
+    }
+
+    inline double GeoCircle::minAngle(double longitude, double latitude, const Rect& bound) noexcept
+    {
+        double result = std::numeric_limits<double>::max();
+        angles(longitude, latitude, bound, false, result);
+        return result;
+    }
+
+    inline double GeoCircle::maxAngle(double longitude, double latitude, const Rect& bound) noexcept
+    {
+        double result = 0;
+        angles(longitude, latitude, bound, true, result);
+        return result;
+    }
+
+    inline void GeoCircle::angles(double longitude, double latitude, const Rect& bound, bool farthest, double& result) noexcept
+    {
+        const double degree = 3.14159265358979323846 / 180;
+        double south = std::max(bound.y, -90.0);
+        double north = std::min(bound.y + bound.height, 90.0);
+        if (south > north) return;
+
+        // At a fixed latitude the distance grows with the longitude difference up to the opposite meridian,
+        // so the extremes lie on the west and east edges, on the own meridian or on the opposite one.
+        std::vector<double> meridians = { bound.x, bound.x + bound.width };
+        double target = farthest ? longitude + 180 : longitude;
+        double offset = std::fmod(target - bound.x, 360.0);
+        if (offset < 0) offset += 360;
+        if (offset <= bound.width) meridians.push_back(target);
+
+        for (double meridian : meridians)
+        {
+            // Along a meridian the cosine of the distance is a sinusoid of the latitude, its extremes are the
+            // ends of the segment or the latitudes where its derivative vanishes
+            double critical = std::atan2(std::sin(latitude * degree), std::cos(latitude * degree) * std::cos((meridian - longitude) * degree)) / degree;
+            for (double candidate : { south, north, critical, critical - 180, critical + 180 })
+            {
+                if (candidate < south || candidate > north) continue;
+
+                double a = angle(longitude, latitude, meridian, candidate);
+                result = farthest ? std::max(result, a) : std::min(result, a);
+            }
+        }
+    }
+
+    /** Sphere implementation */
+    inline bool Sphere::intersects(const Box& other) const noexcept
+    {
+        // Distance from the center to the closest point of the box
+        double dx = std::max({ other.x - x, 0.0, x - (other.x + other.width) });
+        double dy = std::max({ other.y - y, 0.0, y - (other.y + other.height) });
+        double dz = std::max({ other.z - z, 0.0, z - (other.z + other.depth) });
+        return (dx * dx) + (dy * dy) + (dz * dz) <= (radius * radius);
+    }
+
+    inline bool Sphere::contains(const Box& other) const noexcept
+    {
+        // The farthest corner of the box has to be inside the sphere
+        double dx = std::max(std::abs(x - other.x), std::abs(other.x + other.width - x));
+        double dy = std::max(std::abs(y - other.y), std::abs(other.y + other.height - y));
+        double dz = std::max(std::abs(z - other.z), std::abs(other.z + other.depth - z));
+        return (radius * radius) >= (dx * dx) + (dy * dy) + (dz * dz);
+    }
+
     /** Rectangle implementation */
-    inline bool Rect::intersects(const Rect& other) const noexcept 
+    inline bool Rect::intersects(const Rect& other) const noexcept
     {
         if (x > other.x + other.width)  return false;
         if (x + width < other.x)        return false;
@@ -448,4 +3848,138 @@ namespace qtree
             return true;
         return false;
     }
-}
\ No newline at end of file
+
+    /** ConvexPolygon implementation */
+    inline ConvexPolygon::ConvexPolygon(std::vector<Point> vertices) :
+        m_vertices(std::move(vertices)),
+        m_minX(std::numeric_limits<double>::max()),
+        m_minY(std::numeric_limits<double>::max()),
+        m_maxX(std::numeric_limits<double>::lowest()),
+        m_maxY(std::numeric_limits<double>::lowest())
+    {
+        // Make the winding counter clockwise so all the normals point outwards
+        double area = 0;
+        for (size_t i = 0; i < m_vertices.size(); i++)
+        {
+            const Point& a = m_vertices[i];
+            const Point& b = m_vertices[(i + 1) % m_vertices.size()];
+            area += a.x * b.y - b.x * a.y;
+        }
+        if (area < 0) std::reverse(m_vertices.begin(), m_vertices.end());
+
+        m_edges.reserve(m_vertices.size());
+        for (size_t i = 0; i < m_vertices.size(); i++)
+        {
+            const Point& a = m_vertices[i];
+            const Point& b = m_vertices[(i + 1) % m_vertices.size()];
+            double nx = b.y - a.y;
+            double ny = a.x - b.x;
+            m_edges.push_back({ nx, ny, nx * a.x + ny * a.y });
+
+            m_minX = std::min(m_minX, a.x);
+            m_minY = std::min(m_minY, a.y);
+            m_maxX = std::max(m_maxX, a.x);
+            m_maxY = std::max(m_maxY, a.y);
+        }
+    }
+
+    inline bool ConvexPolygon::intersects(const Rect& other) const noexcept
+    {
+        // The rect axes
+        if (m_minX > other.x + other.width)  return false;
+        if (m_maxX < other.x)                return false;
+        if (m_minY > other.y + other.height) return false;
+        if (m_maxY < other.y)                return false;
+
+        // The polygon axes, the rect is separated if its closest corner is outside of an edge
+        for (const Edge& edge : m_edges)
+        {
+            double x = edge.nx > 0 ? other.x : other.x + other.width;
+            double y = edge.ny > 0 ? other.y : other.y + other.height;
+            if (edge.nx * x + edge.ny * y > edge.offset) return false;
+        }
+        return true;
+    }
+
+    inline bool ConvexPolygon::contains(const Rect& other) const noexcept
+    {
+        // The farthest corner along every edge normal has to be inside of the edge
+        for (const Edge& edge : m_edges)
+        {
+            double x = edge.nx > 0 ? other.x + other.width : other.x;
+            double y = edge.ny > 0 ? other.y + other.height : other.y;
+            if (edge.nx * x + edge.ny * y > edge.offset) return false;
+        }
+        return !m_edges.empty();
+    }
+
+    /** OrientedRect implementation */
+    inline OrientedRect::OrientedRect(double x, double y, double width, double height, double angle) :
+        ConvexPolygon(corners(x, y, width, height, angle)),
+        x(x),
+        y(y),
+        width(width),
+        height(height),
+        angle(angle)
+    {}
+
+    inline std::vector<Point> OrientedRect::corners(double x, double y, double width, double height, double angle)
+    {
+        double c = std::cos(angle), s = std::sin(angle);
+        double hw = width / 2, hh = height / 2;
+        return {
+            Point(x - hw * c + hh * s, y - hw * s - hh * c),
+            Point(x + hw * c + hh * s, y + hw * s - hh * c),
+            Point(x + hw * c - hh * s, y + hw * s + hh * c),
+            Point(x - hw * c - hh * s, y - hw * s + hh * c)
+        };
+    }
+
+    /** Frustum implementation */
+    inline Frustum::Frustum(double x, double y, double direction, double fov, double nearPlane, double farPlane) :
+        ConvexPolygon(corners(x, y, direction, fov, nearPlane, farPlane)),
+        x(x),
+        y(y),
+        direction(direction),
+        fov(fov),
+        nearPlane(nearPlane),
+        farPlane(farPlane)
+    {}
+
+    inline std::vector<Point> Frustum::corners(double x, double y, double direction, double fov, double nearPlane, double farPlane)
+    {
+        // The side edges go through the eye, the near and far edges are perpendicular to the view direction
+        double left = direction - fov / 2, right = direction + fov / 2;
+        double nearSide = nearPlane / std::cos(fov / 2), farSide = farPlane / std::cos(fov / 2);
+        return {
+            Point(x + nearSide * std::cos(left),  y + nearSide * std::sin(left)),
+            Point(x + farSide * std::cos(left),   y + farSide * std::sin(left)),
+            Point(x + farSide * std::cos(right),  y + farSide * std::sin(right)),
+            Point(x + nearSide * std::cos(right), y + nearSide * std::sin(right))
+        };
+    }
+
+    /** Box implementation */
+    inline bool Box::intersects(const Box& other) const noexcept
+    {
+        if (x > other.x + other.width)  return false;
+        if (x + width < other.x)        return false;
+        if (y > other.y + other.height) return false;
+        if (y + height < other.y)       return false;
+        if (z > other.z + other.depth)  return false;
+        if (z + depth < other.z)        return false;
+        return true;
+    }
+
+    inline bool Box::contains(const Box& other) const noexcept
+    {
+        if ((other.x + other.width) < (x + width)
+            && (other.x) > (x)
+            && (other.y) > (y)
+            && (other.y + other.height) < (y + height)
+            && (other.z) > (z)
+            && (other.z + other.depth) < (z + depth))
+            return true;
+        return false;
+    }
+}
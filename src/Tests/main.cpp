@@ -0,0 +1,1328 @@
+// Includes
+// STL
+#include <iostream>
+#include <random>
+#include <vector>
+#include <set>
+#include <map>
+#include <string>
+#include <cmath>
+#include <algorithm>
+
+#include "Quadtree.h"
+
+// Every check compares the quadtree against a brute force pass over all the objects
+#define CHECK(condition) \
+    do { if (!(condition)) { std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " << #condition << std::endl; return false; } } while (0)
+
+namespace
+{
+    using Nodes = std::set<const qtree::Node<int>*>;
+
+    const double SIZE = 1000; // Side of the square space of the planar checks
+
+    /** Squared distance between the centers of two point bounds, wrapping around when toroidal */
+    double distance2(const qtree::Rect& a, const qtree::Rect& b, bool toroidal)
+    {
+        double dx = std::abs(a.x - b.x), dy = std::abs(a.y - b.y);
+        if (toroidal)
+        {
+            dx = std::min(dx, SIZE - dx);
+            dy = std::min(dy, SIZE - dy);
+        }
+        return dx * dx + dy * dy;
+    }
+
+    /** True if the bound intersects the range, or one of its images shifted by the period when toroidal */
+    bool reaches(const qtree::Shape& range, const qtree::Rect& bound, bool toroidal)
+    {
+        for (int i = -1; i <= 1; i++)
+            for (int j = -1; j <= 1; j++)
+                if ((toroidal || (i == 0 && j == 0)) && range.intersects(qtree::Rect(bound.x + i * SIZE, bound.y + j * SIZE, bound.width, bound.height)))
+                    return true;
+        return false;
+    }
+
+    /** All the live objects of the quadtree */
+    Nodes all(qtree::QuadTree<int>& tree)
+    {
+        auto found = tree.query(qtree::Rect(-SIZE, -SIZE, 3 * SIZE, 3 * SIZE));
+        return Nodes(found.begin(), found.end());
+    }
+
+    /** The amount of cells of the quadtree */
+    size_t cells(const qtree::QuadTree<int>& tree)
+    {
+        size_t count = 0;
+        tree.draw([&](const qtree::Rect&) { count++; });
+        return count;
+    }
+
+    /** True if no axis separates the convex polygon from the bound, the axes are the ones of the bound and the edge normals */
+    bool overlaps(const std::vector<qtree::Point>& polygon, const qtree::Rect& bound)
+    {
+        const qtree::Point corners[] = { { bound.x, bound.y }, { bound.x + bound.width, bound.y },
+                                         { bound.x + bound.width, bound.y + bound.height }, { bound.x, bound.y + bound.height } };
+        std::vector<qtree::Point> axes = { { 1, 0 }, { 0, 1 } };
+        for (size_t i = 0; i < polygon.size(); i++)
+        {
+            const qtree::Point& a = polygon[i];
+            const qtree::Point& b = polygon[(i + 1) % polygon.size()];
+            axes.emplace_back(b.y - a.y, a.x - b.x);
+        }
+
+        for (const auto& axis : axes)
+        {
+            double low = INFINITY, high = -INFINITY, boundLow = INFINITY, boundHigh = -INFINITY;
+            for (const auto& point : polygon)
+            {
+                low = std::min(low, axis.x * point.x + axis.y * point.y);
+                high = std::max(high, axis.x * point.x + axis.y * point.y);
+            }
+            for (const auto& point : corners)
+            {
+                boundLow = std::min(boundLow, axis.x * point.x + axis.y * point.y);
+                boundHigh = std::max(boundHigh, axis.x * point.x + axis.y * point.y);
+            }
+            if (high < boundLow || boundHigh < low) return false;
+        }
+        return true;
+    }
+
+    /** Box and sphere queries of an octree, against testing every object */
+    bool octree()
+    {
+        std::mt19937 rng(7);
+        std::uniform_real_distribution<double> position(0, SIZE - 30), size(0, 30), radius(10, 300);
+
+        qtree::Octree<int> tree(qtree::Box(0, 0, 0, SIZE, SIZE, SIZE), 4);
+        std::vector<int> objects(4000);
+        std::vector<qtree::Box> bounds;
+        for (size_t i = 0; i < objects.size(); i++)
+        {
+            objects[i] = int(i);
+            if (i % 2) bounds.emplace_back(position(rng), position(rng), position(rng), 1, 1, 1);
+            else bounds.emplace_back(position(rng), position(rng), position(rng), size(rng), size(rng), size(rng));
+            if (i % 2) tree.insert(objects[i], bounds.back().x, bounds.back().y, bounds.back().z);
+            else tree.insert(objects[i], bounds.back());
+        }
+
+        // Every third object is removed
+        std::vector<bool> live(objects.size(), true);
+        for (const auto* node : tree.query(qtree::Box(0, 0, 0, SIZE, SIZE, SIZE)))
+        {
+            if (*node->data % 3) continue;
+            live[*node->data] = false;
+            tree.remove(*node);
+        }
+
+        for (int i = 0; i < 100; i++)
+        {
+            qtree::Box box(position(rng) - 100, position(rng) - 100, position(rng) - 100, radius(rng), radius(rng), radius(rng));
+            qtree::Sphere sphere(position(rng), position(rng), position(rng), radius(rng));
+
+            std::set<int> inBox, inSphere;
+            for (size_t j = 0; j < objects.size(); j++)
+            {
+                if (!live[j]) continue;
+                const qtree::Box& b = bounds[j];
+                if (b.x <= box.x + box.width && box.x <= b.x + b.width && b.y <= box.y + box.height && box.y <= b.y + b.height &&
+                    b.z <= box.z + box.depth && box.z <= b.z + b.depth)
+                    inBox.insert(int(j));
+
+                // Distance from the center of the sphere to the closest point of the bound
+                double dx = sphere.x - std::max(b.x, std::min(sphere.x, b.x + b.width));
+                double dy = sphere.y - std::max(b.y, std::min(sphere.y, b.y + b.height));
+                double dz = sphere.z - std::max(b.z, std::min(sphere.z, b.z + b.depth));
+                if (dx * dx + dy * dy + dz * dz <= sphere.radius * sphere.radius) inSphere.insert(int(j));
+            }
+
+            std::set<int> found;
+            for (const auto* node : tree.query(box)) found.insert(*node->data);
+            CHECK(found == inBox);
+
+            found.clear();
+            for (const auto* node : tree.query(sphere)) found.insert(*node->data);
+            CHECK(found == inSphere);
+        }
+        return true;
+    }
+
+    /** Merging back after removals, with and without the hysteresis, against the live objects */
+    bool merge()
+    {
+        std::mt19937 rng(8);
+        std::uniform_real_distribution<double> position(0, SIZE - 2);
+
+        for (unsigned threshold : { 0u, 3u })
+        {
+            qtree::QuadTree<int> tree(qtree::Rect(0, 0, SIZE, SIZE), 4);
+            tree.setMergeThreshold(threshold);
+            std::vector<int> objects(2000);
+            for (int& object : objects)
+                tree.insert(object, position(rng), position(rng));
+
+            // Remove the objects in batches until none is left, the tree holds exactly the others
+            Nodes live = all(tree);
+            std::vector<const qtree::Node<int>*> order(live.begin(), live.end());
+            std::shuffle(order.begin(), order.end(), rng);
+            for (size_t i = 0; i < order.size(); i++)
+            {
+                tree.remove(*order[i]);
+                live.erase(order[i]);
+                if (i % 97 && live.size() > 4) continue;
+
+                CHECK(all(tree) == live);
+
+                // Below the threshold the root is merged back into a single leaf
+                if (live.size() < std::max(threshold, 1u)) CHECK(cells(tree) == 1);
+            }
+            CHECK(cells(tree) == 1);
+        }
+
+        // Five objects on the diagonal split the root, the hysteresis keeps it split until fewer than three are left
+        for (unsigned threshold : { 0u, 3u })
+        {
+            qtree::QuadTree<int> tree(qtree::Rect(0, 0, SIZE, SIZE), 4);
+            tree.setMergeThreshold(threshold);
+            std::vector<int> objects(5);
+            std::vector<const qtree::Node<int>*> nodes;
+            for (size_t i = 0; i < objects.size(); i++)
+            {
+                tree.insert(objects[i], 10 + 100 * i, 10 + 100 * i);
+                nodes.push_back(*tree.query(qtree::Rect(10 + 100 * i, 10 + 100 * i, 0, 0)).begin());
+            }
+            CHECK(cells(tree) > 1);
+
+            for (size_t i = 0; i < 4; i++)
+            {
+                tree.remove(*nodes[i]);
+                size_t left = objects.size() - i - 1;
+                CHECK(all(tree).size() == left);
+
+                // Without the hysteresis only the empty subtrees are merged, the path to the last object stays
+                if (threshold && left < threshold) CHECK(cells(tree) == 1);
+                else CHECK(cells(tree) > 1);
+            }
+        }
+        return true;
+    }
+
+    /** Deferred removals followed by compact(), against removing immediately */
+    bool deferred()
+    {
+        std::mt19937 rng(9);
+        std::uniform_real_distribution<double> position(0, SIZE - 20), size(0, 20);
+
+        qtree::QuadTree<int> immediate(qtree::Rect(0, 0, SIZE, SIZE), 4), deferred(qtree::Rect(0, 0, SIZE, SIZE), 4);
+        deferred.setDeferredRemoval(true);
+        std::vector<int> objects(3000);
+        std::map<int, const qtree::Node<int>*> immediateNodes, deferredNodes;
+        for (size_t i = 0; i < objects.size(); i++)
+        {
+            objects[i] = int(i);
+            qtree::Rect bound(position(rng), position(rng), size(rng), size(rng));
+            immediate.insert(objects[i], bound);
+            deferred.insert(objects[i], bound);
+        }
+        for (const auto* node : all(immediate)) immediateNodes[*node->data] = node;
+        for (const auto* node : all(deferred)) deferredNodes[*node->data] = node;
+
+        // The same objects of both trees, by their data
+        auto same = [&](const std::unordered_set<const qtree::Node<int>*>& a, const std::unordered_set<const qtree::Node<int>*>& b) {
+            std::set<int> left, right;
+            for (const auto* node : a) left.insert(*node->data);
+            for (const auto* node : b) right.insert(*node->data);
+            return left == right;
+        };
+
+        for (int round = 0; round < 5; round++)
+        {
+            for (int i = 0; i < 300; i++)
+            {
+                int object = int(rng() % objects.size());
+                if (!immediateNodes.count(object)) continue;
+                immediate.remove(*immediateNodes[object]);
+                deferred.remove(*deferredNodes[object]);
+                immediateNodes.erase(object);
+                deferredNodes.erase(object);
+            }
+
+            qtree::Circle circle(position(rng), position(rng), 150);
+            auto odd = [](const qtree::Node<int>& node) { return *node.data % 2 != 0; };
+            CHECK(immediate.removeIf(circle, odd) == deferred.removeIf(circle, odd));
+            Nodes left = all(immediate);
+            for (auto it = immediateNodes.begin(); it != immediateNodes.end();)
+            {
+                if (left.count(it->second)) { ++it; continue; }
+                deferredNodes.erase(it->first);
+                it = immediateNodes.erase(it);
+            }
+
+            // The dead objects are skipped before they are compacted
+            for (int i = 0; i < 20; i++)
+            {
+                qtree::Rect range(position(rng), position(rng), 200, 200);
+                CHECK(same(immediate.query(range), deferred.query(range)));
+            }
+
+            deferred.compact();
+            CHECK(same(immediate.query(qtree::Rect(0, 0, SIZE, SIZE)), deferred.query(qtree::Rect(0, 0, SIZE, SIZE))));
+            CHECK(cells(immediate) == cells(deferred));
+        }
+        return true;
+    }
+
+    /** removeIf(), against filtering the objects in range */
+    bool removeif()
+    {
+        std::mt19937 rng(10);
+        std::uniform_real_distribution<double> position(0, SIZE - 40), size(0, 40), radius(20, 300);
+
+        for (bool deferred : { false, true })
+        {
+            qtree::QuadTree<int> tree(qtree::Rect(0, 0, SIZE, SIZE), 4);
+            tree.setDeferredRemoval(deferred);
+            std::vector<int> objects(4000);
+            for (size_t i = 0; i < objects.size(); i++)
+            {
+                objects[i] = int(i);
+                tree.insert(objects[i], qtree::Rect(position(rng), position(rng), size(rng), size(rng)));
+            }
+
+            for (int i = 0; i < 20; i++)
+            {
+                qtree::Circle circle(position(rng), position(rng), radius(rng));
+                int modulo = 2 + i % 3;
+
+                Nodes before = all(tree), inRange, expected;
+                for (const auto* node : before)
+                    if (reaches(circle, node->bound, false)) inRange.insert(node);
+                for (const auto* node : inRange)
+                    if (*node->data % modulo == 0) expected.insert(node);
+
+                // The predicate is asked once about every object in range, even about the ones split between cells
+                std::map<const qtree::Node<int>*, int> asked;
+                size_t removed = tree.removeIf(circle, [&](const qtree::Node<int>& node) {
+                    asked[&node]++;
+                    return *node.data % modulo == 0;
+                });
+                CHECK(removed == expected.size());
+                CHECK(asked.size() == inRange.size());
+                for (const auto& count : asked)
+                    CHECK(count.second == 1 && inRange.count(count.first));
+
+                if (deferred && i % 2) tree.compact();
+
+                Nodes after = all(tree);
+                CHECK(after.size() == before.size() - expected.size());
+                for (const auto* node : expected)
+                    CHECK(!after.count(node));
+            }
+        }
+        return true;
+    }
+
+    /** Cursors paused and resumed, against query() */
+    bool cursor()
+    {
+        std::mt19937 rng(11);
+        std::uniform_real_distribution<double> position(0, SIZE - 40), size(0, 40), radius(20, 400);
+
+        qtree::QuadTree<int> tree(qtree::Rect(0, 0, SIZE, SIZE), 4);
+        std::vector<int> objects(4000);
+        for (int& object : objects)
+            tree.insert(object, qtree::Rect(position(rng), position(rng), size(rng), size(rng)));
+
+        for (int i = 0; i < 30; i++)
+        {
+            qtree::Circle circle(position(rng), position(rng), radius(rng));
+            qtree::Rect rect(position(rng) - 200, position(rng) - 200, radius(rng), radius(rng));
+            auto circleFound = tree.query(circle), rectFound = tree.query(rect);
+
+            // Two cursors advance by a few steps in turn, with other queries in between
+            auto first = tree.cursor(circle), second = tree.cursor(rect);
+            Nodes firstSeen, secondSeen;
+            while (!first.done() || !second.done())
+            {
+                for (unsigned step = rng() % 8; step > 0 && !first.done(); step--)
+                {
+                    const auto* node = first.next();
+                    if (node) CHECK(firstSeen.insert(node).second);
+                }
+                tree.query(qtree::Rect(position(rng), position(rng), 50, 50));
+                for (unsigned step = rng() % 8; step > 0 && !second.done(); step--)
+                {
+                    const auto* node = second.next();
+                    if (node) CHECK(secondSeen.insert(node).second);
+                }
+            }
+            CHECK(first.next() == nullptr);
+
+            CHECK(firstSeen == Nodes(circleFound.begin(), circleFound.end()));
+            CHECK(secondSeen == Nodes(rectFound.begin(), rectFound.end()));
+        }
+        return true;
+    }
+
+    /** A quadtree in an arena, released and refilled every round, against testing every object */
+    bool arena()
+    {
+        std::mt19937 rng(12);
+        std::uniform_real_distribution<double> position(0, SIZE - 20), size(0, 20);
+
+        qtree::MonotonicResource arena(4096);
+        qtree::QuadTree<int> tree(qtree::Rect(0, 0, SIZE, SIZE), 4, &arena);
+        std::vector<int> objects(3000);
+        for (int round = 0; round < 5; round++)
+        {
+            // The amount of objects changes every round, so the arena does not see the same allocations again
+            std::vector<qtree::Rect> bounds;
+            size_t count = objects.size() / (1 + round % 3);
+            for (size_t i = 0; i < count; i++)
+            {
+                objects[i] = int(i);
+                bounds.emplace_back(position(rng), position(rng), size(rng), size(rng));
+                tree.insert(objects[i], bounds.back());
+            }
+            CHECK(all(tree).size() == count);
+
+            for (int i = 0; i < 20; i++)
+            {
+                qtree::Circle circle(position(rng), position(rng), 100);
+                std::set<int> expected, found;
+                for (size_t j = 0; j < count; j++)
+                    if (reaches(circle, bounds[j], false)) expected.insert(int(j));
+                for (const auto* node : tree.query(circle))
+                    found.insert(*node->data);
+                CHECK(found == expected);
+            }
+
+            tree.release();
+            CHECK(all(tree).empty());
+            CHECK(cells(tree) == 1);
+            arena.release();
+        }
+        return true;
+    }
+
+    /** Snapshots after the live quadtree moves and removes objects, against the bounds at the time of the snapshot */
+    bool snapshot()
+    {
+        std::mt19937 rng(13);
+        std::uniform_real_distribution<double> position(0, SIZE - 20), size(0, 20);
+
+        qtree::QuadTree<int> tree(qtree::Rect(0, 0, SIZE, SIZE), 4);
+        std::vector<int> objects(3000);
+        std::vector<qtree::Rect> bounds;
+        for (size_t i = 0; i < objects.size(); i++)
+        {
+            objects[i] = int(i);
+            bounds.emplace_back(position(rng), position(rng), size(rng), size(rng));
+            tree.insert(objects[i], bounds.back());
+        }
+        std::vector<bool> live(objects.size(), true);
+
+        for (int round = 0; round < 5; round++)
+        {
+            qtree::Snapshot<int> snapshot = tree.snapshot();
+            std::vector<qtree::Rect> taken = bounds;
+            std::vector<bool> takenLive = live;
+
+            // The live quadtree moves some objects and removes others
+            for (const auto* node : all(tree))
+            {
+                int object = *node->data;
+                if (rng() % 4 == 0)
+                {
+                    bounds[object] = qtree::Rect(position(rng), position(rng), size(rng), size(rng));
+                    tree.move(*node, bounds[object]);
+                }
+                else if (rng() % 10 == 0)
+                {
+                    live[object] = false;
+                    tree.remove(*node);
+                }
+            }
+
+            for (int i = 0; i < 20; i++)
+            {
+                qtree::Rect range(position(rng), position(rng), 150, 150);
+                std::set<int> expected, found;
+                for (size_t j = 0; j < objects.size(); j++)
+                    if (takenLive[j] && reaches(range, taken[j], false)) expected.insert(int(j));
+
+                for (const auto& object : snapshot.query(range))
+                {
+                    CHECK(found.insert(*object.data).second);
+                    const qtree::Rect& bound = taken[*object.data];
+                    CHECK(object.bound.x == bound.x && object.bound.y == bound.y && object.bound.width == bound.width && object.bound.height == bound.height);
+                }
+                CHECK(found == expected);
+            }
+        }
+        return true;
+    }
+
+    /** cachedQuery() after edits inside and outside the range, against a fresh query() */
+    bool cache()
+    {
+        std::mt19937 rng(14);
+        std::uniform_real_distribution<double> position(0, SIZE - 10), far(700, SIZE - 10), near(200, 390);
+
+        qtree::QuadTree<int> tree(qtree::Rect(0, 0, SIZE, SIZE), 4);
+        std::vector<int> objects(3000);
+        for (size_t i = 0; i < objects.size(); i++)
+        {
+            objects[i] = int(i);
+            tree.insert(objects[i], qtree::Rect(position(rng), position(rng), 5, 5));
+        }
+
+        const qtree::Rect range(200, 200, 200, 200);
+        for (int round = 0; round < 20; round++)
+        {
+            const auto* cached = &tree.cachedQuery(range);
+            std::unordered_set<const qtree::Node<int>*> before = *cached;
+            CHECK(before == tree.query(range));
+
+            // Edits far from the range leave the remembered result in place
+            for (const auto* node : tree.query(qtree::Rect(700, 700, SIZE - 700, SIZE - 700)))
+                if (node->bound.x >= 700 && node->bound.y >= 700)
+                    tree.move(*node, qtree::Rect(far(rng), far(rng), 5, 5));
+            const auto& reused = tree.cachedQuery(range);
+            CHECK(&reused == cached);
+            CHECK(reused == before);
+            CHECK(reused == tree.query(range));
+
+            // Moving an object into the range, and one out of it, changes the result
+            const auto* in = *all(tree).begin();
+            tree.move(*in, qtree::Rect(near(rng), near(rng), 5, 5));
+            const qtree::Node<int>* out = nullptr;
+            for (const auto* node : tree.query(range))
+                if (node != in) out = node;
+            tree.move(*out, qtree::Rect(far(rng), far(rng), 5, 5));
+            const auto& changed = tree.cachedQuery(range);
+            CHECK(changed.count(in) && !changed.count(out));
+            CHECK(changed == tree.query(range));
+        }
+        return true;
+    }
+
+    /** Convex polygon queries in both winding orders, against a separating axis test of every object */
+    bool polygon()
+    {
+        std::mt19937 rng(15);
+        std::uniform_real_distribution<double> position(0, SIZE - 20), size(0, 20), radius(10, 300), turn(0, 2 * 3.14159265358979323846);
+
+        qtree::QuadTree<int> tree(qtree::Rect(0, 0, SIZE, SIZE), 4);
+        std::vector<int> objects(3000);
+        for (size_t i = 0; i < objects.size(); i++)
+        {
+            objects[i] = int(i);
+            tree.insert(objects[i], qtree::Rect(position(rng), position(rng), size(rng), size(rng)));
+        }
+        Nodes nodes = all(tree);
+
+        for (int i = 0; i < 100; i++)
+        {
+            // Vertices on a circle at increasing angles are convex, reversed half of the time
+            std::vector<double> angles(3 + rng() % 8);
+            for (auto& angle : angles) angle = turn(rng);
+            std::sort(angles.begin(), angles.end());
+            double x = position(rng), y = position(rng), r = radius(rng);
+            std::vector<qtree::Point> vertices;
+            for (double angle : angles)
+                vertices.emplace_back(x + r * std::cos(angle), y + r * std::sin(angle));
+            if (i % 2) std::reverse(vertices.begin(), vertices.end());
+
+            Nodes expected, found;
+            for (const auto* node : nodes)
+                if (overlaps(vertices, node->bound)) expected.insert(node);
+            for (const auto* node : tree.query(qtree::ConvexPolygon(vertices)))
+                found.insert(node);
+            CHECK(found == expected);
+        }
+        return true;
+    }
+
+    /** Oriented rectangle and view frustum queries, against a separating axis test with their corners */
+    bool oriented()
+    {
+        const double pi = 3.14159265358979323846;
+        std::mt19937 rng(16);
+        std::uniform_real_distribution<double> position(0, SIZE - 20), size(0, 20), side(1, 400), turn(-pi, pi), fov(0.1, 2.5);
+
+        qtree::QuadTree<int> tree(qtree::Rect(0, 0, SIZE, SIZE), 4);
+        std::vector<int> objects(3000);
+        for (size_t i = 0; i < objects.size(); i++)
+        {
+            objects[i] = int(i);
+            tree.insert(objects[i], qtree::Rect(position(rng), position(rng), size(rng), size(rng)));
+        }
+        Nodes nodes = all(tree);
+
+        for (int i = 0; i < 100; i++)
+        {
+            double x = position(rng), y = position(rng), angle = turn(rng);
+            double ux = std::cos(angle), uy = std::sin(angle); // Along the width, or the view direction
+            double vx = -uy, vy = ux;
+
+            double width = side(rng), height = side(rng);
+            std::vector<qtree::Point> rect;
+            for (auto corner : { std::make_pair(-1, -1), std::make_pair(1, -1), std::make_pair(1, 1), std::make_pair(-1, 1) })
+                rect.emplace_back(x + (corner.first * width * ux + corner.second * height * vx) / 2,
+                                  y + (corner.first * width * uy + corner.second * height * vy) / 2);
+
+            // The near and far edges span the field of view at their distance along the view direction
+            double angleOfView = fov(rng), nearPlane = side(rng) / 4, farPlane = nearPlane + side(rng);
+            double spread = std::tan(angleOfView / 2);
+            std::vector<qtree::Point> frustum;
+            for (auto corner : { std::make_pair(nearPlane, -1), std::make_pair(farPlane, -1), std::make_pair(farPlane, 1), std::make_pair(nearPlane, 1) })
+                frustum.emplace_back(x + corner.first * (ux + corner.second * spread * vx),
+                                     y + corner.first * (uy + corner.second * spread * vy));
+
+            Nodes expectedRect, expectedFrustum, foundRect, foundFrustum;
+            for (const auto* node : nodes)
+            {
+                if (overlaps(rect, node->bound)) expectedRect.insert(node);
+                if (overlaps(frustum, node->bound)) expectedFrustum.insert(node);
+            }
+            for (const auto* node : tree.query(qtree::OrientedRect(x, y, width, height, angle)))
+                foundRect.insert(node);
+            for (const auto* node : tree.query(qtree::Frustum(x, y, angle, angleOfView, nearPlane, farPlane)))
+                foundFrustum.insert(node);
+            CHECK(foundRect == expectedRect);
+            CHECK(foundFrustum == expectedFrustum);
+        }
+        return true;
+    }
+
+    /** Auto grow from tight bounds towards objects far outside of them, against testing every object */
+    bool grow()
+    {
+        std::mt19937 rng(17);
+        std::uniform_real_distribution<double> position(-5 * SIZE, 5 * SIZE), size(0, 20), side(10, 2000);
+
+        qtree::QuadTree<int> tree(qtree::Rect(SIZE / 2, SIZE / 2, 10, 10), 4);
+        tree.setAutoGrow(true);
+        std::vector<int> objects(3000);
+        std::vector<qtree::Rect> bounds;
+        for (size_t i = 0; i < objects.size(); i++)
+        {
+            // The objects spread further and further, moving earlier objects outside grows the quadtree as well
+            objects[i] = int(i);
+            double spread = 0.1 + 0.9 * i / objects.size();
+            bounds.emplace_back(position(rng) * spread, position(rng) * spread, size(rng), size(rng));
+            CHECK(tree.insert(objects[i], bounds.back()));
+            if (i % 10 == 0)
+            {
+                const auto* node = *tree.query(bounds[i / 2]).begin();
+                bounds[*node->data] = qtree::Rect(position(rng), position(rng), size(rng), size(rng));
+                tree.move(*node, bounds[*node->data]);
+            }
+        }
+
+        auto nodes = tree.query(qtree::Rect(-6 * SIZE, -6 * SIZE, 12 * SIZE, 12 * SIZE));
+        CHECK(nodes.size() == objects.size());
+        for (const auto* node : nodes)
+            CHECK(tree.query(bounds[*node->data]).count(node));
+
+        for (int i = 0; i < 100; i++)
+        {
+            qtree::Rect range(position(rng), position(rng), side(rng), side(rng));
+            std::set<int> expected, found;
+            for (size_t j = 0; j < objects.size(); j++)
+                if (reaches(range, bounds[j], false)) expected.insert(int(j));
+            for (const auto* node : tree.query(range))
+                found.insert(*node->data);
+            CHECK(found == expected);
+        }
+        return true;
+    }
+
+    /** GeoCircle queries and nearest() in geographic mode, against haversine distances */
+    bool geographic()
+    {
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<double> longitude(-180, 180), latitude(-90, 90), sine(-1, 1), radius(1e3, 3e6);
+
+        qtree::QuadTree<int> tree(qtree::Rect(-180, -90, 360, 180), 4);
+        tree.setGeographic(true);
+
+        // Uniform on the sphere, so the poles are not crowded
+        std::vector<int> objects(2000);
+        std::vector<qtree::Point> positions;
+        for (int& object : objects)
+        {
+            positions.emplace_back(longitude(rng), std::asin(sine(rng)) * 180 / 3.14159265358979323846);
+            tree.insert(object, positions.back());
+        }
+
+        for (int i = 0; i < 200; i++)
+        {
+            // Also around the antimeridian and the poles
+            qtree::GeoCircle circle(i % 10 == 0 ? 179.5 : longitude(rng), i % 13 == 0 ? 89.0 : latitude(rng), radius(rng));
+            size_t expected = 0;
+            for (const qtree::Point& position : positions)
+                expected += qtree::GeoCircle::angle(circle.longitude, circle.latitude, position.x, position.y) * circle.sphereRadius <= circle.radius;
+            CHECK(tree.query(circle).size() == expected);
+
+            qtree::Point point(longitude(rng), latitude(rng));
+            std::vector<double> angles;
+            for (const qtree::Point& position : positions)
+                angles.push_back(qtree::GeoCircle::angle(point.x, point.y, position.x, position.y));
+            std::sort(angles.begin(), angles.end());
+
+            auto nearest = tree.nearest(point, 4);
+            CHECK(nearest.size() == 4);
+            for (size_t k = 0; k < nearest.size(); k++)
+                CHECK(std::abs(qtree::GeoCircle::angle(point.x, point.y, nearest[k]->bound.x, nearest[k]->bound.y) - angles[k]) < 1e-12);
+        }
+        return true;
+    }
+
+    /** Queries restricted to layers, after moves and removals, against filtering the objects in range by their mask */
+    bool layers()
+    {
+        std::mt19937 rng(18);
+        std::uniform_real_distribution<double> position(0, SIZE - 20), size(0, 20), side(10, 400);
+
+        for (bool toroidal : { false, true })
+        {
+            qtree::QuadTree<int> tree(qtree::Rect(0, 0, SIZE, SIZE), 4);
+            tree.setToroidal(toroidal);
+            // Few layers each, some objects without layers belong to all of them
+            std::vector<int> objects(3000);
+            for (size_t i = 0; i < objects.size(); i++)
+            {
+                objects[i] = int(i);
+                qtree::Rect bound(position(rng), position(rng), size(rng), size(rng));
+                if (i % 50 == 0) tree.insert(objects[i], bound);
+                else tree.insert(objects[i], bound, qtree::Mask(1) << (rng() % 8));
+            }
+
+            for (int i = 0; i < 50; i++)
+            {
+                for (const auto* node : tree.query(qtree::Circle(position(rng), position(rng), 30)))
+                {
+                    if (rng() % 2) tree.remove(*node);
+                    else tree.move(*node, qtree::Rect(position(rng), position(rng), size(rng), size(rng)));
+                }
+
+                qtree::Rect range(position(rng) - 100, position(rng) - 100, side(rng), side(rng));
+                qtree::Mask mask = qtree::Mask(rng()) & qtree::Mask(rng()) & 0xff;
+                Nodes expected, found;
+                for (const auto* node : all(tree))
+                    if ((node->mask & mask) && reaches(range, node->bound, toroidal)) expected.insert(node);
+                for (const auto* node : tree.query(range, mask))
+                    found.insert(node);
+                CHECK(found == expected);
+            }
+        }
+        return true;
+    }
+
+    /** The pairs accumulated from the updatePairs() events, after inserts, moves and removals, against testing all the pairs */
+    bool pairs()
+    {
+        std::mt19937 rng(19);
+        std::uniform_real_distribution<double> position(0, SIZE - 30), size(0, 30);
+
+        for (bool toroidal : { false, true })
+        {
+            qtree::QuadTree<int> tree(qtree::Rect(0, 0, SIZE, SIZE), 4);
+            tree.setToroidal(toroidal);
+            std::vector<int> objects(2000);
+            for (size_t i = 0; i < objects.size() / 2; i++)
+            {
+                objects[i] = int(i);
+                tree.insert(objects[i], qtree::Rect(position(rng), position(rng), size(rng), size(rng)));
+            }
+            // The objects already in the quadtree are paired by the first update
+            tree.setPairTracking(true);
+
+            std::set<std::pair<const qtree::Node<int>*, const qtree::Node<int>*>> pairs;
+            size_t inserted = objects.size() / 2;
+            for (int round = 0; round < 20; round++)
+            {
+                if (round)
+                {
+                    for (const auto* node : tree.query(qtree::Circle(position(rng), position(rng), 100)))
+                    {
+                        if (rng() % 3 == 0) tree.remove(*node);
+                        else tree.move(*node, qtree::Rect(position(rng), position(rng), size(rng), size(rng)));
+                    }
+                    for (int i = 0; i < 25; i++, inserted++)
+                    {
+                        objects[inserted] = int(inserted);
+                        tree.insert(objects[inserted], qtree::Rect(position(rng), position(rng), size(rng), size(rng)));
+                    }
+                }
+
+                auto events = tree.updatePairs();
+                for (const auto& pair : events.end)
+                    CHECK(pairs.erase({ pair.first, pair.second }));
+                for (const auto& pair : events.begin)
+                {
+                    CHECK(pair.first < pair.second);
+                    CHECK(pairs.insert({ pair.first, pair.second }).second);
+                }
+
+                Nodes nodes = all(tree);
+                std::vector<const qtree::Node<int>*> list(nodes.begin(), nodes.end());
+                std::set<std::pair<const qtree::Node<int>*, const qtree::Node<int>*>> expected, current;
+                for (size_t i = 0; i < list.size(); i++)
+                    for (size_t j = i + 1; j < list.size(); j++)
+                        if (reaches(list[i]->bound, list[j]->bound, toroidal)) expected.insert({ list[i], list[j] });
+                CHECK(pairs == expected);
+
+                tree.forEachPair([&](const qtree::Node<int>& a, const qtree::Node<int>& b) { current.insert({ &a, &b }); });
+                CHECK(current == expected);
+            }
+        }
+        return true;
+    }
+
+    /** The objects accumulated from the updateSubscriptions() events, with moving observers, against querying every region */
+    bool subscriptions()
+    {
+        std::mt19937 rng(20);
+        std::uniform_real_distribution<double> position(0, SIZE - 30), size(0, 30), side(20, 300);
+
+        for (bool toroidal : { false, true })
+        {
+            qtree::QuadTree<int> tree(qtree::Rect(0, 0, SIZE, SIZE), 4);
+            tree.setToroidal(toroidal);
+            std::vector<int> objects(3000);
+            for (size_t i = 0; i < objects.size(); i++)
+            {
+                objects[i] = int(i);
+                tree.insert(objects[i], qtree::Rect(position(rng), position(rng), size(rng), size(rng)));
+            }
+
+            std::map<size_t, qtree::Rect> regions;
+            std::map<size_t, Nodes> seen;
+            for (int i = 0; i < 20; i++)
+            {
+                qtree::Rect region(position(rng), position(rng), side(rng), side(rng));
+                regions.emplace(tree.subscribe(region), region);
+            }
+
+            for (int round = 0; round < 30; round++)
+            {
+                if (round)
+                {
+                    for (const auto* node : tree.query(qtree::Circle(position(rng), position(rng), 100)))
+                    {
+                        if (rng() % 4 == 0) tree.remove(*node);
+                        else tree.move(*node, qtree::Rect(position(rng), position(rng), size(rng), size(rng)));
+                    }
+                    for (auto& region : regions)
+                    {
+                        if (rng() % 3) continue;
+                        region.second = qtree::Rect(position(rng), position(rng), side(rng), side(rng));
+                        tree.setRegion(region.first, region.second);
+                    }
+                    // An observer leaves without events, and another one joins
+                    auto gone = regions.begin();
+                    std::advance(gone, rng() % regions.size());
+                    tree.unsubscribe(gone->first);
+                    seen.erase(gone->first);
+                    regions.erase(gone);
+                    qtree::Rect region(position(rng), position(rng), side(rng), side(rng));
+                    regions.emplace(tree.subscribe(region), region);
+                }
+
+                auto events = tree.updateSubscriptions();
+                for (const auto& event : events.leave)
+                    CHECK(seen[event.observer].erase(event.node));
+                for (const auto& event : events.enter)
+                    CHECK(seen[event.observer].insert(event.node).second);
+
+                Nodes nodes = all(tree);
+                for (const auto& region : regions)
+                {
+                    Nodes expected;
+                    for (const auto* node : nodes)
+                        if (reaches(region.second, node->bound, toroidal)) expected.insert(node);
+                    const auto& visible = tree.visible(region.first);
+                    CHECK(seen[region.first] == expected);
+                    CHECK(Nodes(visible.begin(), visible.end()) == expected);
+                }
+            }
+        }
+        return true;
+    }
+
+    /** buildNeighbourLists(), on one and several threads, against all the pairs */
+    bool neighbours()
+    {
+        std::mt19937 rng(2);
+        std::uniform_real_distribution<double> position(0, SIZE - 2);
+        const double radius = 40;
+
+        for (bool toroidal : { false, true })
+        {
+            for (unsigned threads : { 1u, 4u })
+            {
+                qtree::QuadTree<int> tree(qtree::Rect(0, 0, SIZE, SIZE), 8);
+                tree.setToroidal(toroidal);
+                std::vector<int> objects(2000);
+                for (int& object : objects)
+                    tree.insert(object, position(rng), position(rng));
+
+                // Removed objects have no list
+                for (const auto* node : all(tree))
+                    if (rng() % 10 == 0) tree.remove(*node);
+
+                auto lists = tree.buildNeighbourLists(radius, threads);
+                size_t count = lists.nodes.size();
+                CHECK(count == all(tree).size());
+                CHECK(lists.offsets.size() == count + 1 && lists.offsets.back() == lists.indices.size());
+
+                for (size_t i = 0; i < count; i++)
+                {
+                    std::vector<size_t> expected;
+                    for (size_t j = 0; j < count; j++)
+                        if (i != j && distance2(lists.nodes[i]->bound, lists.nodes[j]->bound, toroidal) <= radius * radius)
+                            expected.push_back(j);
+
+                    CHECK(std::vector<size_t>(lists.indices.begin() + lists.offsets[i], lists.indices.begin() + lists.offsets[i + 1]) == expected);
+                }
+            }
+        }
+        return true;
+    }
+
+    /** Approximate nearest(), with and without a budget, against sorting all the objects by distance */
+    bool approximate()
+    {
+        std::mt19937 rng(21);
+        std::uniform_real_distribution<double> position(0, SIZE - 20), size(0, 20), epsilon(0, 1);
+
+        qtree::QuadTree<int> tree(qtree::Rect(0, 0, SIZE, SIZE), 4);
+        std::vector<int> objects(3000);
+        for (size_t i = 0; i < objects.size(); i++)
+        {
+            objects[i] = int(i);
+            tree.insert(objects[i], qtree::Rect(position(rng), position(rng), size(rng), size(rng)));
+        }
+        Nodes nodes = all(tree);
+
+        for (int i = 0; i < 100; i++)
+        {
+            qtree::Point point(position(rng), position(rng));
+            auto distance = [&](const qtree::Node<int>* node) {
+                double dx = std::max({ node->bound.x - point.x, 0.0, point.x - node->bound.x - node->bound.width });
+                double dy = std::max({ node->bound.y - point.y, 0.0, point.y - node->bound.y - node->bound.height });
+                return std::sqrt(dx * dx + dy * dy);
+            };
+            std::vector<double> exact;
+            for (const auto* node : nodes)
+                exact.push_back(distance(node));
+            std::sort(exact.begin(), exact.end());
+
+            // The kth object found is at most (1 + epsilon) farther than the exact kth nearest
+            size_t k = 1 + rng() % 20;
+            double e = i % 4 ? epsilon(rng) : 0;
+            auto found = tree.nearest(point, k, e);
+            CHECK(found.size() == k);
+            for (size_t j = 0; j < k; j++)
+            {
+                CHECK(nodes.count(found[j]));
+                CHECK(j == 0 || distance(found[j - 1]) <= distance(found[j]));
+            }
+            CHECK(distance(found.back()) <= exact[k - 1] * (1 + e));
+            if (e == 0) CHECK(distance(found.back()) == exact[k - 1]);
+
+            // A larger budget continues the same search further, so the kth distance never gets worse
+            double previous = std::numeric_limits<double>::infinity();
+            CHECK(tree.nearest(point, k, e, 0).empty());
+            for (size_t budget = 1; budget < 200; budget *= 2)
+            {
+                auto partial = tree.nearest(point, k, e, budget);
+                CHECK(partial.size() <= k);
+                double kth = partial.size() == k ? distance(partial.back()) : std::numeric_limits<double>::infinity();
+                CHECK(kth <= previous);
+                previous = kth;
+            }
+        }
+
+        // The first visited cell is the root, which only keeps the objects inserted before it split
+        auto root = tree.nearest(qtree::Point(SIZE / 2, SIZE / 2), 10, 0, 1);
+        CHECK(root.size() == 4);
+        for (const auto* node : root)
+            CHECK(*node->data < 4);
+        return true;
+    }
+
+    /** dbscan(), on one and several threads, against a brute force DBSCAN */
+    bool dbscan()
+    {
+        std::mt19937 rng(3);
+        std::uniform_real_distribution<double> position(0, SIZE - 2);
+        std::normal_distribution<double> spread(0, 12);
+        const double eps = 6;
+        const size_t minPoints = 5;
+
+        for (bool toroidal : { false, true })
+        {
+            for (unsigned threads : { 1u, 3u })
+            {
+                qtree::QuadTree<int> tree(qtree::Rect(0, 0, SIZE, SIZE), 8);
+                tree.setToroidal(toroidal);
+
+                // Blobs around random centers, two of them across the left and right edges, and some noise
+                std::vector<qtree::Point> centers;
+                for (int i = 0; i < 10; i++) centers.emplace_back(position(rng), position(rng));
+                centers.emplace_back(2, SIZE / 2);
+                centers.emplace_back(SIZE - 4, SIZE / 2);
+
+                std::vector<int> objects(3000);
+                for (size_t i = 0; i < objects.size(); i++)
+                {
+                    qtree::Point point(position(rng), position(rng));
+                    if (i % 5)
+                    {
+                        const qtree::Point& center = centers[i % centers.size()];
+                        point.x = std::min(std::fmod(center.x + spread(rng) + SIZE, SIZE), SIZE - 2);
+                        point.y = std::min(std::fmod(center.y + spread(rng) + SIZE, SIZE), SIZE - 2);
+                    }
+                    tree.insert(objects[i], point);
+                }
+
+                auto clustering = tree.dbscan(eps, minPoints, threads);
+                size_t count = clustering.nodes.size();
+                CHECK(count == objects.size() && clustering.labels.size() == count);
+                auto near = [&](size_t i, size_t j) { return distance2(clustering.nodes[i]->bound, clustering.nodes[j]->bound, toroidal) <= eps * eps; };
+
+                std::vector<bool> core(count);
+                for (size_t i = 0; i < count; i++)
+                {
+                    size_t neighbours = 0;
+                    for (size_t j = 0; j < count; j++) neighbours += near(i, j);
+                    core[i] = neighbours >= minPoints;
+                }
+
+                // The connected components of the core objects are the clusters
+                std::vector<int> component(count, -1);
+                int components = 0;
+                for (size_t i = 0; i < count; i++)
+                {
+                    if (!core[i] || component[i] >= 0) continue;
+
+                    std::vector<size_t> stack(1, i);
+                    component[i] = components;
+                    while (!stack.empty())
+                    {
+                        size_t current = stack.back();
+                        stack.pop_back();
+                        for (size_t j = 0; j < count; j++)
+                        {
+                            if (core[j] && component[j] < 0 && near(current, j))
+                            {
+                                component[j] = components;
+                                stack.push_back(j);
+                            }
+                        }
+                    }
+                    components++;
+                }
+                CHECK(clustering.clusters == size_t(components));
+
+                // The labels may be numbered differently, but a component has a single label
+                std::map<int, int> labels;
+                for (size_t i = 0; i < count; i++)
+                {
+                    if (!core[i]) continue;
+                    CHECK(clustering.labels[i] >= 0);
+                    CHECK(labels.emplace(component[i], clustering.labels[i]).first->second == clustering.labels[i]);
+                }
+
+                // A border object joins the cluster of one of its core neighbours, the others are noise
+                for (size_t i = 0; i < count; i++)
+                {
+                    if (core[i]) continue;
+
+                    bool border = false, joined = false;
+                    for (size_t j = 0; j < count; j++)
+                    {
+                        if (!core[j] || !near(i, j)) continue;
+                        border = true;
+                        joined = joined || labels[component[j]] == clustering.labels[i];
+                    }
+                    CHECK(border ? joined : clustering.labels[i] == -1);
+                }
+            }
+        }
+        return true;
+    }
+
+    /** heatmap(), with removals and moves, against binning every object by its center */
+    bool heatmap()
+    {
+        std::mt19937 rng(4);
+        std::uniform_real_distribution<double> position(0, SIZE - 40), size(0, 40);
+
+        for (bool deferred : { false, true })
+        {
+            qtree::QuadTree<int> tree(qtree::Rect(0, 0, SIZE, SIZE), 4);
+            tree.setDeferredRemoval(deferred);
+            // Points, and larger objects split between cells which may be centered outside the cell owning them
+            std::vector<int> objects(5000);
+            for (size_t i = 0; i < objects.size(); i++)
+            {
+                if (i % 4) tree.insert(objects[i], position(rng), position(rng));
+                else tree.insert(objects[i], qtree::Rect(position(rng), position(rng), size(rng), size(rng)));
+            }
+
+            for (const auto* node : tree.query(qtree::Circle(300, 300, 150)))
+                tree.remove(*node);
+            for (const auto* node : tree.query(qtree::Circle(700, 700, 150)))
+                tree.move(*node, qtree::Rect(position(rng), position(rng), size(rng), size(rng)));
+
+            const qtree::Rect areas[] = { qtree::Rect(0, 0, SIZE, SIZE), qtree::Rect(110, 230, 500, 310), qtree::Rect(500, 0, 250, SIZE) };
+            const size_t sizes[][2] = { { 4, 4 }, { 7, 5 }, { 16, 16 }, { 1, 1 } };
+            for (int pass = 0; pass < 2; pass++)
+            {
+                for (const qtree::Rect& area : areas)
+                {
+                    for (const auto& size : sizes)
+                    {
+                        std::vector<size_t> expected(size[0] * size[1], 0);
+                        for (const auto* node : all(tree))
+                        {
+                            double x = node->bound.x + node->bound.width / 2 - area.x;
+                            double y = node->bound.y + node->bound.height / 2 - area.y;
+                            if (x < 0 || y < 0 || x > area.width || y > area.height) continue;
+
+                            size_t column = std::min(size_t(x / area.width * size[0]), size[0] - 1);
+                            size_t row = std::min(size_t(y / area.height * size[1]), size[1] - 1);
+                            expected[row * size[0] + column]++;
+                        }
+
+                        std::vector<size_t> grid;
+                        tree.heatmap(area, size[0], size[1], grid);
+                        CHECK(grid == expected);
+                    }
+                }
+
+                // Again once the deferred removals are compacted
+                if (deferred) tree.compact();
+            }
+        }
+        return true;
+    }
+
+    /** The range queries and removeIf() of a toroidal quadtree, against the images of every object */
+    bool toroidal()
+    {
+        std::mt19937 rng(5);
+        std::uniform_real_distribution<double> position(0, SIZE - 10), size(1, 40);
+
+        qtree::QuadTree<int> tree(qtree::Rect(0, 0, SIZE, SIZE), 4);
+        tree.setToroidal(true);
+        std::vector<int> objects(3000);
+        for (size_t i = 0; i < objects.size(); i++)
+        {
+            objects[i] = int(i);
+            tree.insert(objects[i], qtree::Rect(position(rng), position(rng), size(rng) / 4, size(rng) / 4));
+        }
+
+        for (int i = 0; i < 40; i++)
+        {
+            qtree::Rect rect(position(rng) - 200, position(rng) - 200, size(rng) * 6, size(rng) * 6);
+            qtree::Circle circle(position(rng), position(rng), size(rng) * 3);
+            for (const qtree::Shape* range : { static_cast<const qtree::Shape*>(&rect), static_cast<const qtree::Shape*>(&circle) })
+            {
+                Nodes expected;
+                for (const auto* node : all(tree))
+                    if (reaches(*range, node->bound, true)) expected.insert(node);
+
+                auto found = tree.query(*range);
+                CHECK(Nodes(found.begin(), found.end()) == expected);
+
+                Nodes cursor;
+                for (auto it = tree.cursor(*range); !it.done();)
+                {
+                    const auto* node = it.next();
+                    if (node) CHECK(cursor.insert(node).second);
+                }
+                CHECK(cursor == expected);
+
+                std::mt19937 draws(i);
+                for (const auto* node : tree.sample(*range, 5, draws))
+                    CHECK(expected.count(node));
+            }
+
+            Nodes expected;
+            for (const auto* node : all(tree))
+                if (reaches(rect, node->bound, true)) expected.insert(node);
+            const auto& cached = tree.cachedQuery(rect);
+            CHECK(Nodes(cached.begin(), cached.end()) == expected);
+        }
+
+        // Remove the odd objects around the corners, where the range wraps on both axes
+        for (bool deferred : { false, true })
+        {
+            tree.setDeferredRemoval(deferred);
+            qtree::Circle corner(deferred ? SIZE - 5 : 5, deferred ? 5 : SIZE - 5, 80);
+
+            Nodes before = all(tree), expected;
+            for (const auto* node : before)
+                if (reaches(corner, node->bound, true) && *node->data % 2) expected.insert(node);
+
+            CHECK(tree.removeIf(corner, [](const qtree::Node<int>& node) { return *node.data % 2 != 0; }) == expected.size());
+            if (deferred) tree.compact();
+
+            Nodes after = all(tree);
+            CHECK(after.size() == before.size() - expected.size());
+            for (const auto* node : expected)
+                CHECK(!after.count(node));
+        }
+        return true;
+    }
+
+    /** topK(), with rescored objects, against sorting the objects in range by score */
+    bool topk()
+    {
+        std::mt19937 rng(6);
+        std::uniform_real_distribution<double> position(0, SIZE - 10), size(1, 300);
+
+        for (bool toroidal : { false, true })
+        {
+            qtree::QuadTree<int> tree(qtree::Rect(0, 0, SIZE, SIZE), 4);
+            tree.setToroidal(toroidal);
+            // Distinct scores in a shuffled order, so the ranking is unique
+            std::vector<int> objects(3000);
+            for (size_t i = 0; i < objects.size(); i++)
+            {
+                objects[i] = int(i * 7919 % 3001);
+                tree.insert(objects[i], qtree::Rect(position(rng), position(rng), 2, 2));
+            }
+
+            tree.setScore([](const int& object) { return double(object); });
+            for (int i = 0; i < 50; i++)
+            {
+                for (const auto* node : tree.query(qtree::Circle(position(rng), position(rng), 20)))
+                {
+                    *node->data += 3001;
+                    tree.rescore(*node);
+                }
+
+                qtree::Rect range(position(rng) - 100, position(rng) - 100, size(rng), size(rng));
+                std::vector<std::pair<double, const qtree::Node<int>*>> expected;
+                for (const auto* node : all(tree))
+                    if (reaches(range, node->bound, toroidal)) expected.emplace_back(node->score, node);
+                std::sort(expected.begin(), expected.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+                size_t k = 1 + rng() % 20;
+                auto best = tree.topK(range, k);
+                CHECK(best.size() == std::min(k, expected.size()));
+                for (size_t j = 0; j < best.size(); j++)
+                    CHECK(best[j] == expected[j].second);
+            }
+        }
+        return true;
+    }
+
+    /** queryAt() in the past and the future, with new trajectories and a tighten(), against predicting every object */
+    bool moving()
+    {
+        std::mt19937 rng(22);
+        std::uniform_real_distribution<double> position(100, SIZE - 120), size(0, 20), speed(-5, 5), time(-10, 10), side(10, 300);
+
+        qtree::QuadTree<int> tree(qtree::Rect(0, 0, SIZE, SIZE), 4);
+        tree.setMoving(true);
+        // Every object is at its bound at its own time, some of them stand still
+        std::vector<int> objects(3000);
+        std::vector<qtree::Rect> bounds;
+        std::vector<qtree::QuadTree<int>::Velocity> velocities;
+        std::vector<double> times;
+        for (size_t i = 0; i < objects.size(); i++)
+        {
+            objects[i] = int(i);
+            bounds.emplace_back(position(rng), position(rng), size(rng), size(rng));
+            velocities.push_back(i % 10 ? qtree::QuadTree<int>::Velocity{ speed(rng), speed(rng) } : qtree::QuadTree<int>::Velocity{});
+            times.push_back(time(rng) / 4);
+            tree.insert(objects[i], bounds[i], velocities[i], times[i]);
+        }
+
+        for (int round = 0; round < 6; round++)
+        {
+            if (round == 3) tree.tighten(time(rng) / 2);
+            for (const auto* node : tree.query(qtree::Circle(position(rng), position(rng), 50)))
+            {
+                int object = *node->data;
+                bounds[object] = qtree::Rect(position(rng), position(rng), size(rng), size(rng));
+                velocities[object] = { speed(rng), speed(rng) };
+                times[object] = time(rng) / 4;
+                tree.move(*node, bounds[object], velocities[object], times[object]);
+            }
+
+            for (int i = 0; i < 30; i++)
+            {
+                double t = time(rng);
+                qtree::Rect range(position(rng) - 100, position(rng) - 100, side(rng), side(rng));
+                std::set<int> expected, found;
+                for (size_t j = 0; j < objects.size(); j++)
+                {
+                    qtree::Rect predicted(bounds[j].x + velocities[j][0] * (t - times[j]), bounds[j].y + velocities[j][1] * (t - times[j]),
+                                          bounds[j].width, bounds[j].height);
+                    if (reaches(range, predicted, false)) expected.insert(int(j));
+                }
+                for (const auto* node : tree.queryAt(range, t))
+                    found.insert(*node->data);
+                CHECK(found == expected);
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const std::map<std::string, bool(*)()> checks = {
+        { "octree", octree },
+        { "merge", merge },
+        { "deferred", deferred },
+        { "removeif", removeif },
+        { "cursor", cursor },
+        { "arena", arena },
+        { "snapshot", snapshot },
+        { "cache", cache },
+        { "polygon", polygon },
+        { "oriented", oriented },
+        { "grow", grow },
+        { "geographic", geographic },
+        { "layers", layers },
+        { "pairs", pairs },
+        { "subscriptions", subscriptions },
+        { "neighbours", neighbours },
+        { "approximate", approximate },
+        { "dbscan", dbscan },
+        { "heatmap", heatmap },
+        { "toroidal", toroidal },
+        { "topk", topk },
+        { "moving", moving },
+    };
+
+    // Run the given check, or all of them
+    bool passed = true;
+    for (const auto& check : checks)
+    {
+        if (argc > 1 && check.first != argv[1]) continue;
+
+        bool result = check.second();
+        std::cout << check.first << ": " << (result ? "passed" : "FAILED") << std::endl;
+        passed = passed && result;
+    }
+
+    if (argc > 1 && !checks.count(argv[1]))
+    {
+        std::cerr << "unknown check: " << argv[1] << std::endl;
+        return 1;
+    }
+
+    return passed ? 0 : 1;
+}
@@ -1,5 +1,7 @@
 #include "Utils.h"
 
+#include <cmath>
+
 #include "Quadtree.h"
 
 void Utils::drawCircle(sf::RenderTarget& window, const qtree::Circle& data, const sf::Color& outlineColor)
@@ -24,6 +26,41 @@ void Utils::drawRectangle(sf::RenderTarget& window, const qtree::Rect& rect, con
     window.draw(rectangle);
 }
 
+void Utils::drawCircle(sf::VertexArray& batch, const qtree::Circle& data, const sf::Color& outlineColor)
+{
+    // Same amount of points sf::CircleShape uses by default
+    static const int SEGMENTS = 30;
+    static const float PI = 3.141592654f;
+
+    sf::Vector2f center((float)data.x, (float)data.y);
+    sf::Vector2f previous(center.x + (float)data.radius, center.y);
+    for (int i = 1; i <= SEGMENTS; i++)
+    {
+        float angle = i * 2 * PI / SEGMENTS;
+        sf::Vector2f current(center.x + (float)data.radius * std::cos(angle), center.y + (float)data.radius * std::sin(angle));
+        batch.append(sf::Vertex(previous, outlineColor));
+        batch.append(sf::Vertex(current, outlineColor));
+        previous = current;
+    }
+}
+
+void Utils::drawRectangle(sf::VertexArray& batch, const qtree::Rect& rect, const sf::Color& outlineColor)
+{
+    sf::Vector2f topLeft((float)rect.x, (float)rect.y);
+    sf::Vector2f topRight((float)(rect.x + rect.width), (float)rect.y);
+    sf::Vector2f bottomRight((float)(rect.x + rect.width), (float)(rect.y + rect.height));
+    sf::Vector2f bottomLeft((float)rect.x, (float)(rect.y + rect.height));
+
+    batch.append(sf::Vertex(topLeft, outlineColor));
+    batch.append(sf::Vertex(topRight, outlineColor));
+    batch.append(sf::Vertex(topRight, outlineColor));
+    batch.append(sf::Vertex(bottomRight, outlineColor));
+    batch.append(sf::Vertex(bottomRight, outlineColor));
+    batch.append(sf::Vertex(bottomLeft, outlineColor));
+    batch.append(sf::Vertex(bottomLeft, outlineColor));
+    batch.append(sf::Vertex(topLeft, outlineColor));
+}
+
 int Utils::getRandom(int max)
 {
     return rand() % max + 1;
@@ -14,6 +14,9 @@ class Utils
 public:
 	static void drawCircle(sf::RenderTarget& window, const qtree::Circle& data, const sf::Color& outlineColor);
 	static void drawRectangle(sf::RenderTarget& window, const qtree::Rect& rect, const sf::Color& outlineColor);
+	// Batched versions, append the outline as sf::Lines to the given array which is then drawn once per frame
+	static void drawCircle(sf::VertexArray& batch, const qtree::Circle& data, const sf::Color& outlineColor);
+	static void drawRectangle(sf::VertexArray& batch, const qtree::Rect& rect, const sf::Color& outlineColor);
 	static int getRandom(int max);
 };
 